@@ -18,11 +18,18 @@
 
 #include "abstractimagedownloader.h"
 
+#include <QtCore/QDateTime>
 #include <QtCore/QFileInfo>
+#include <QtCore/QUrl>
 #include <QtCore/QDir>
 #include <QtCore/QCryptographicHash>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImage>
 #include <QtGui/QImageReader>
+#include <QtGui/QImageWriter>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
 #include <QtNetwork/QNetworkRequest>
@@ -31,11 +38,18 @@
 
 #include "abstractimagedownloader_p.h"
 
+#include <algorithm>
+#include <functional>
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
 // The AbstractImageDownloader is a class used to build image downloader objects
 //
 // An image downloader object is a QObject based object that lives in
-// a lower priority thread, downloads images from social networks
-// and updates a database.
+// a lower priority thread (see startWorkerThread()), downloads images
+// from social networks and updates a database.
 //
 // This object do not expose many methods. Instead, since it lives
 // in it's own thread, communications should be done using signals
@@ -45,67 +59,521 @@
 // should be used, and when the download is completed, the
 // AbstractImagesDownloaderPrivate::imageDownloaded will be emitted.
 
-static int MAX_SIMULTANEOUS_DOWNLOAD = 5;
+static int DEFAULT_MAX_DOWNLOADS = 8;
+static int DEFAULT_MAX_HOST_DOWNLOADS = 6;
+static const qreal INITIAL_HOST_WINDOW = 2;
 static int MAX_BATCH_SAVE = 50;
 
+// Downloads still running after this long are abandoned
+static const int DOWNLOAD_TIMEOUT = 60000;
+
+// Replies never buffer more than this; data is moved to disk as it arrives
+static const qint64 DOWNLOAD_BUFFER_SIZE = 64 * 1024;
+
+static const char *PRIORITY_KEY = "priority";
+static const char *EXPIRES_KEY = "expires";
+static const char *ETAG_KEY = "etag";
+static const char *LAST_MODIFIED_KEY = "lastModified";
+static const char *NOT_MODIFIED_KEY = "notModified";
+static const char *CONTENT_HASH_KEY = "contentHash";
+static const char *RESUME_OFFSET_KEY = "resumeOffset";
+static const char *RESUME_VALIDATOR_KEY = "resumeValidator";
+
+// Partial downloads older than this are started over
+static const int MAX_PARTIAL_AGE_DAYS = 7;
+
+// Enough leading bytes to tell every supported format apart
+static const int IMAGE_SIGNATURE_SIZE = 12;
+
+enum ImageSignature {
+    IncompleteSignature,
+    ImageSignatureFound,
+    NotAnImage
+};
+
+// Recognizes the JPEG, PNG, GIF and WebP signatures
+static ImageSignature sniffImage(const QByteArray &header)
+{
+    if (header.startsWith("\xFF\xD8\xFF")
+            || header.startsWith("\x89PNG\r\n\x1A\n")
+            || header.startsWith("GIF87a")
+            || header.startsWith("GIF89a")
+            || (header.startsWith("RIFF") && header.mid(8, 4) == "WEBP")) {
+        return ImageSignatureFound;
+    }
+    return header.size() < IMAGE_SIGNATURE_SIZE ? IncompleteSignature : NotAnImage;
+}
+
+// Rejects responses declaring a non-image type. Servers omitting the type or
+// sending a generic one are judged by the content alone.
+static bool acceptableContentType(const QNetworkReply *reply)
+{
+    const QByteArray contentType = reply->header(QNetworkRequest::ContentTypeHeader).toByteArray().toLower();
+    return contentType.isEmpty()
+            || contentType.startsWith("image/")
+            || contentType.startsWith("application/octet-stream")
+            || contentType.startsWith("binary/octet-stream");
+}
+
+static QString partialFileName(const QString &fileName)
+{
+    return fileName + QLatin1String(".part");
+}
+
+// Holds the validator of a partial download kept for resuming
+static QString validatorFileName(const QString &fileName)
+{
+    return partialFileName(fileName) + QLatin1String(".validator");
+}
+
+static void discardPartial(const QString &fileName)
+{
+    QFile::remove(partialFileName(fileName));
+    QFile::remove(validatorFileName(fileName));
+}
+
+// Returns the validator of a partial download that can be resumed, or an
+// empty one if the download has to start over.
+static QByteArray resumeValidator(const QString &fileName)
+{
+    const QFileInfo partialInfo(partialFileName(fileName));
+    if (!partialInfo.exists() || partialInfo.size() == 0
+            || partialInfo.lastModified().daysTo(QDateTime::currentDateTime()) > MAX_PARTIAL_AGE_DAYS) {
+        return QByteArray();
+    }
+
+    QFile validatorFile(validatorFileName(fileName));
+    if (!validatorFile.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return validatorFile.readAll().trimmed();
+}
+
+// Keeps what was received of a download interrupted by a timeout or a
+// network failure, along with a validator to resume it with If-Range.
+static bool keepPartial(ImageInfo *info, QNetworkReply *reply)
+{
+    if (info->invalid || info->writeFailed || info->file.size() == 0
+            || reply->error() == QNetworkReply::NoError
+            || reply->error() >= QNetworkReply::ProxyConnectionRefusedError) {
+        return false;
+    }
+
+    const int statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray validator = info->resumeValidator;
+    if (statusCode == 200 || (statusCode == 206 && info->resumeOffset > 0)) {
+        // Weak entity tags cannot be used for range requests
+        const QByteArray etag = reply->rawHeader("ETag");
+        if (!etag.isEmpty() && !etag.startsWith("W/")) {
+            validator = etag;
+        } else if (reply->hasRawHeader("Last-Modified")) {
+            validator = reply->rawHeader("Last-Modified");
+        }
+    } else {
+        validator.clear();
+    }
+    if (validator.isEmpty()) {
+        return false;
+    }
+
+    QFile validatorFile(validatorFileName(info->fileName));
+    if (!validatorFile.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            || validatorFile.write(validator) != validator.size()) {
+        return false;
+    }
+    return true;
+}
+
+// Start of the body of a 206 response, from its Content-Range header.
+static qint64 contentRangeStart(const QNetworkReply *reply)
+{
+    const QByteArray contentRange = reply->rawHeader("Content-Range");
+    if (!contentRange.startsWith("bytes ")) {
+        return -1;
+    }
+    bool ok = false;
+    const qint64 start = contentRange.mid(6, contentRange.indexOf('-') - 6).trimmed().toLongLong(&ok);
+    return ok ? start : -1;
+}
+
+static const int THUMBNAIL_QUALITY = 85;
+
+// Kept apart from the global pool so scaling never delays other work. Its
+// default thread count is the number of cores.
+Q_GLOBAL_STATIC(QThreadPool, thumbnailThreadPool)
+
+// Scales a downloaded image to each thumbnail size, decoding the file only
+// once at the largest size needed.
+class ThumbnailJob : public QRunnable
+{
+public:
+    ThumbnailJob(const QSharedPointer<ThumbnailSink> &sink, const QString &url,
+                 const QString &imageFile, const QVariantMap &metadata, const QList<int> &sizes)
+        : m_sink(sink), m_url(url), m_imageFile(imageFile), m_metadata(metadata), m_sizes(sizes)
+    {
+    }
+
+    void run()
+    {
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+
+        QVariantMap thumbnailFiles;
+        QImageReader reader(m_imageFile);
+        QImage image;
+        QSize imageSize = reader.size();
+        if (!imageSize.isValid()) {
+            image = reader.read();
+            imageSize = image.size();
+        }
+
+        Q_FOREACH (int size, m_sizes) {
+            if (imageSize.isEmpty()) {
+                break;
+            }
+            if (imageSize.width() <= size && imageSize.height() <= size) {
+                // the image itself is small enough
+                continue;
+            }
+
+            const QSize scaledSize = imageSize.scaled(size, size, Qt::KeepAspectRatio);
+            if (image.isNull()) {
+                reader.setScaledSize(scaledSize);
+                image = reader.read();
+                if (image.isNull()) {
+                    qWarning() << Q_FUNC_INFO << "Failed to decode" << m_imageFile << reader.errorString();
+                    break;
+                }
+            }
+            if (image.size() != scaledSize) {
+                image = image.scaled(scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
+
+            const QString thumbnailFile = AbstractImageDownloader::makeThumbnailFile(m_imageFile, size);
+            QDir().mkpath(QFileInfo(thumbnailFile).absolutePath());
+            const QString partialName = partialFileName(thumbnailFile);
+            QImageWriter writer(partialName, "jpg");
+            writer.setQuality(THUMBNAIL_QUALITY);
+            if (writer.write(image)
+                    && ::rename(QFile::encodeName(partialName).constData(),
+                                QFile::encodeName(thumbnailFile).constData()) == 0) {
+                thumbnailFiles.insert(QString::number(size), thumbnailFile);
+            } else {
+                qWarning() << Q_FUNC_INFO << "Failed to write thumbnail" << thumbnailFile << writer.errorString();
+                QFile::remove(partialName);
+            }
+        }
+
+        QMutexLocker locker(&m_sink->mutex);
+        if (m_sink->downloader) {
+            QMetaObject::invokeMethod(m_sink->downloader, "thumbnailsCreated", Qt::QueuedConnection,
+                                      Q_ARG(QString, m_url),
+                                      Q_ARG(QVariantMap, m_metadata),
+                                      Q_ARG(QVariantMap, thumbnailFiles));
+        }
+    }
+
+private:
+    QSharedPointer<ThumbnailSink> m_sink;
+    QString m_url;
+    QString m_imageFile;
+    QVariantMap m_metadata;
+    QList<int> m_sizes;
+};
+
 AbstractImageDownloaderPrivate::AbstractImageDownloaderPrivate(AbstractImageDownloader *q)
-    : networkAccessManager(0), q_ptr(q), loadedCount(0)
+    : networkAccessManager(0), q_ptr(q)
+    , replyTimeouts(0)
+    , queuedCount(0), nextSequence(0)
+    , maximumDownloads(DEFAULT_MAX_DOWNLOADS)
+    , maximumHostDownloads(DEFAULT_MAX_HOST_DOWNLOADS)
+    , loadedCount(0)
+    , cacheHits(0)
+    , cacheRevalidated(0)
+    , cacheDownloaded(0)
+    , cacheStatisticsPending(false)
+    , contentAddressed(false)
+    , pendingThumbnails(0)
+    , thumbnailSink(new ThumbnailSink(q))
+    , workerThread(0)
 {
 }
 
 AbstractImageDownloaderPrivate::~AbstractImageDownloaderPrivate()
 {
+    qDeleteAll(images);
+}
+
+void AbstractImageDownloaderPrivate::enqueue(ImageInfo *info)
+{
+    info->host = QUrl(info->redirectUrl.isEmpty() ? info->url : info->redirectUrl).host();
+    info->sequence = nextSequence++;
+
+    Host &host = hosts[info->host];
+    if (host.window == 0) {
+        host.window = qMin<qreal>(INITIAL_HOST_WINDOW, maximumHostDownloads);
+    }
+    host.queuedImages[info->priority].append(info);
+    ++queuedCount;
+}
+
+// Releases the host slot of a finished download and adapts the host's window.
+void AbstractImageDownloaderPrivate::downloadFinished(ImageInfo *info, DownloadOutcome outcome)
+{
+    QHash<QString, Host>::iterator it = hosts.find(info->host);
+    if (it == hosts.end()) {
+        return;
+    }
+
+    Host &host = it.value();
+    --host.running;
+
+    if (outcome == DownloadNeutral) {
+        return;
+    }
+
+    const qint64 latency = qMax<qint64>(1, info->latency >= 0 ? info->latency : info->elapsed.elapsed());
+
+    if (outcome == DownloadFailed || (host.latency > 0 && latency > 2 * host.latency)) {
+        host.window = qMax<qreal>(1, host.window / 2);
+    } else {
+        host.window = qMin<qreal>(maximumHostDownloads, host.window + 1 / host.window);
+    }
+
+    if (outcome == DownloadSucceeded) {
+        host.latency = host.latency > 0
+                ? 0.8 * host.latency + 0.2 * latency
+                : latency;
+    }
+}
+
+// Reports the cache statistics once the current burst of events is handled.
+void AbstractImageDownloaderPrivate::scheduleCacheStatistics()
+{
+    Q_Q(AbstractImageDownloader);
+    if (!cacheStatisticsPending) {
+        cacheStatisticsPending = true;
+        QMetaObject::invokeMethod(q, "reportCacheStatistics", Qt::QueuedConnection);
+    }
+}
+
+void AbstractImageDownloaderPrivate::createThumbnails(const QString &url, const QString &imageFile,
+                                                      const QVariantMap &metadata)
+{
+    ++pendingThumbnails;
+    thumbnailThreadPool()->start(new ThumbnailJob(thumbnailSink, url, imageFile, metadata, thumbnailSizes));
+}
+
+// Forgets a request once it has been answered, and frees it.
+void AbstractImageDownloaderPrivate::finish(ImageInfo *info)
+{
+    images.remove(info->url);
+    delete info;
 }
 
 void AbstractImageDownloaderPrivate::manageStack()
 {
     Q_Q(AbstractImageDownloader);
-    while (runningReplies.count() < MAX_SIMULTANEOUS_DOWNLOAD && !stack.isEmpty()) {
-        // Create a reply to download the image
-        ImageInfo *info = stack.takeLast();
+    while (runningReplies.count() < maximumDownloads && queuedCount > 0) {
+        // Pick the most important image among the hosts with a free slot
+        Host *host = 0;
+        ImageInfo *next = 0;
+        for (QHash<QString, Host>::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+            Host &candidate = it.value();
+            if (candidate.queuedImages.isEmpty() || candidate.running >= int(candidate.window)) {
+                continue;
+            }
+            ImageInfo *head = (candidate.queuedImages.end() - 1)->first();
+            if (!next || head->priority > next->priority
+                    || (head->priority == next->priority && head->sequence < next->sequence)) {
+                host = &candidate;
+                next = head;
+            }
+        }
+
+        if (!host) {
+            break;
+        }
+
+        QMap<int, QList<ImageInfo *> >::iterator highest = host->queuedImages.end() - 1;
+        ImageInfo *info = highest->takeFirst();
+        if (highest->isEmpty()) {
+            host->queuedImages.erase(highest);
+        }
+        --queuedCount;
 
         QString url = info->url;
         if (!info->redirectUrl.isEmpty()) {
             url = info->redirectUrl;
         }
 
-        info->file.setFileName(q->outputFile(url, info->requestsData.first()));
-        QDir parentDir = QFileInfo(info->file.fileName()).dir();
+        info->fileName = q->outputFile(url, info->requestsData.first());
+        QDir parentDir = QFileInfo(info->fileName).dir();
         if (!parentDir.exists()) {
             parentDir.mkpath(".");
         }
 
-        if (QNetworkReply *reply = q->createReply(url, info->requestsData.first())) {
-            QTimer *timer = new QTimer(q);
-            timer->setInterval(60000);
-            timer->setSingleShot(true);
-            QObject::connect(timer, &QTimer::timeout,
-                    q, &AbstractImageDownloader::timedOut);
-            timer->start();
-            replyTimeouts.insert(timer, reply);
-            reply->setProperty("timeoutTimer", QVariant::fromValue<QTimer*>(timer));
+        info->file.setFileName(partialFileName(info->fileName));
+        info->writeFailed = false;
+        info->validated = false;
+        info->invalid = false;
+        info->header.clear();
+        info->latency = -1;
+        info->contentHash.reset();
+
+        QIODevice::OpenMode openMode = QIODevice::WriteOnly | QIODevice::Truncate;
+        info->resumeValidator = resumeValidator(info->fileName);
+        info->resumeOffset = 0;
+        if (!info->resumeValidator.isEmpty()) {
+            info->resumeOffset = info->file.size();
+            openMode = QIODevice::WriteOnly | QIODevice::Append;
+            if (contentAddressed && info->file.open(QIODevice::ReadOnly)) {
+                while (!info->file.atEnd()) {
+                    info->contentHash.addData(info->file.read(DOWNLOAD_BUFFER_SIZE));
+                }
+                info->file.close();
+            }
+        } else {
+            discardPartial(info->fileName);
+        }
+
+        QVariantMap requestMetadata = info->requestsData.first();
+        info->conditional = (requestMetadata.contains(QLatin1String(ETAG_KEY))
+                             || requestMetadata.contains(QLatin1String(LAST_MODIFIED_KEY)))
+                && QFile::exists(info->fileName);
+        if (!info->conditional) {
+            requestMetadata.remove(QLatin1String(ETAG_KEY));
+            requestMetadata.remove(QLatin1String(LAST_MODIFIED_KEY));
+        }
+        if (info->resumeOffset > 0) {
+            requestMetadata.insert(QLatin1String(RESUME_OFFSET_KEY), info->resumeOffset);
+            requestMetadata.insert(QLatin1String(RESUME_VALIDATOR_KEY), info->resumeValidator);
+        }
+
+        if (!info->file.open(openMode)) {
+            qWarning() << Q_FUNC_INFO << "Failed to open file for write" << info->file.errorString();
+            // emit signal.  Empty file signifies error.
+            Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
+                emit q->imageDownloaded(info->url, QString(), metadata);
+            }
+            finish(info);
+            continue;
+        }
+
+        if (QNetworkReply *reply = q->createReply(url, requestMetadata)) {
+            reply->setReadBufferSize(DOWNLOAD_BUFFER_SIZE);
+            ++host->running;
+            info->elapsed.start();
+            replyTimeouts->start(reply, DOWNLOAD_TIMEOUT);
+            QObject::connect(reply, SIGNAL(readyRead()), q, SLOT(readyRead()));
             QObject::connect(reply, SIGNAL(finished()), q, SLOT(slotFinished())); // For some reason, this fixes an issue with oopp sync plugins
             runningReplies.insert(reply, info);
         } else {
+            info->file.close();
+            if (info->resumeOffset == 0) {
+                info->file.remove();
+            }
             // emit signal.  Empty file signifies error.
             Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
                 emit q->imageDownloaded(info->url, QString(), metadata);
             }
-            delete info;
+            finish(info);
         }
     }
 }
 
-static void readData(ImageInfo *info, QNetworkReply *reply)
+// Moves a completed download into place. With content addressing the output
+// file becomes a hard link to the shared copy of its content, which is
+// created from this download if it does not exist yet.
+static bool storeFile(const QString &partialName, const QString &fileName, const QString &contentFile)
+{
+    const QByteArray partial = QFile::encodeName(partialName);
+
+    if (!contentFile.isEmpty()) {
+        const QByteArray content = QFile::encodeName(contentFile);
+        QDir().mkpath(QFileInfo(contentFile).absolutePath());
+        if (::link(partial.constData(), content.constData()) != 0 && errno == EEXIST) {
+            // Already stored; replace the download with a link to the shared copy
+            const QByteArray linkName = partial + ".link";
+            ::unlink(linkName.constData());
+            if (::link(content.constData(), linkName.constData()) == 0) {
+                if (::rename(linkName.constData(), partial.constData()) != 0) {
+                    ::unlink(linkName.constData());
+                }
+            }
+        }
+        // Any other failure, such as a different file system, leaves an unshared file
+    }
+
+    return ::rename(partial.constData(), QFile::encodeName(fileName).constData()) == 0;
+}
+
+// Checks the content type and the first bytes of a successful response, so
+// anything that is not an image is abandoned before it is fully downloaded.
+static void validateData(ImageInfo *info, QNetworkReply *reply, const QByteArray &buf)
 {
-    qint64 bytesAvailable = reply->bytesAvailable();
-    if (bytesAvailable == 0) {
-        qWarning() << Q_FUNC_INFO << "No image data available";
+    const int statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (statusCode != 0 && (statusCode < 200 || statusCode >= 300)) {
+        // redirections and errors are handled once the reply finishes
+        return;
+    }
+
+    if (info->resumeOffset > 0) {
+        if (statusCode == 206) {
+            // the kept bytes were checked by the attempt that received them
+            info->validated = true;
+            if (contentRangeStart(reply) != info->resumeOffset) {
+                qWarning() << Q_FUNC_INFO << "Unexpected range" << reply->rawHeader("Content-Range");
+                info->invalid = true;
+            }
+            return;
+        }
+
+        // the image changed, or the server ignored the range; start over
+        info->file.resize(0);
+        info->contentHash.reset();
+        info->resumeOffset = 0;
+        info->resumeValidator.clear();
+    }
+
+    if (!acceptableContentType(reply)) {
+        info->validated = true;
+        info->invalid = true;
         return;
     }
 
-    QByteArray buf = reply->readAll();
-    info->file.write(buf);
+    info->header.append(buf.left(IMAGE_SIGNATURE_SIZE - info->header.size()));
+    const ImageSignature signature = sniffImage(info->header);
+    if (signature != IncompleteSignature) {
+        info->validated = true;
+        info->invalid = signature == NotAnImage;
+        info->header.clear();
+    }
+}
+
+// Returns false once the data turns out not to be an image.
+static bool readData(ImageInfo *info, QNetworkReply *reply)
+{
+    if (info->latency < 0 && reply->bytesAvailable() > 0) {
+        info->latency = info->elapsed.elapsed();
+    }
+    while (reply->bytesAvailable() > 0 && !info->invalid) {
+        const QByteArray buf = reply->read(DOWNLOAD_BUFFER_SIZE);
+        if (buf.isEmpty()) {
+            break;
+        }
+        if (!info->validated) {
+            validateData(info, reply, buf);
+            if (info->invalid) {
+                break;
+            }
+        }
+        info->contentHash.addData(buf);
+        if (!info->writeFailed && info->file.write(buf) != buf.size()) {
+            qWarning() << Q_FUNC_INFO << "Failed to write image data" << info->file.errorString();
+            info->writeFailed = true;
+        }
+    }
+    return !info->invalid;
 }
 
 void AbstractImageDownloader::readyRead()
@@ -118,8 +586,9 @@ void AbstractImageDownloader::readyRead()
     }
 
     ImageInfo *info = d->runningReplies.value(reply);
-    if (info) {
-        readData(info, reply);
+    if (info && !info->invalid && !readData(info, reply)) {
+        qWarning() << Q_FUNC_INFO << "Not an image, aborting download" << info->url;
+        reply->abort();
     }
 }
 
@@ -135,12 +604,7 @@ void AbstractImageDownloader::slotFinished()
     }
 
     ImageInfo *info = d->runningReplies.take(reply);
-    QTimer *timer = reply->property("timeoutTimer").value<QTimer*>();
-    if (timer) {
-        d->replyTimeouts.remove(timer);
-        timer->stop();
-        timer->deleteLater();
-    }
+    d->replyTimeouts->stop(reply);
     reply->deleteLater();
     if (!info) {
         qWarning() << Q_FUNC_INFO << "No image info associated with reply";
@@ -151,66 +615,132 @@ void AbstractImageDownloader::slotFinished()
     QByteArray redirectedUrl = reply->rawHeader("Location");
     if (redirectedUrl.length() > 0) {
         // this is URL redirection
+        info->file.close();
+        discardPartial(info->fileName);
+        --d->hosts[info->host].running;
         info->redirectUrl = QString(redirectedUrl);
-        d->stack.append(info);
+        d->enqueue(info);
         d->manageStack();
     } else {
-        if (!info->file.open(QIODevice::ReadWrite)) {
-            qWarning() << Q_FUNC_INFO << "Failed to open file for write" << info->file.errorString();
-            Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
-                emit imageDownloaded(info->url, QString(), metadata);
-            }
-            d->manageStack();
-            return;
+        if (!info->invalid) {
+            readData(info, reply);
         }
-
-        const QString fileName = info->file.fileName();
-        readData(info, reply);
         info->file.close();
 
-        QImageReader reader(fileName);
-        if (reader.canRead()) {
-            dbQueueImage(info->url, info->requestsData.first(), fileName);
+        const QString partialName = info->file.fileName();
+        const bool notModified = info->conditional
+                && reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304;
+        bool success = false;
+        if (info->invalid) {
+            // aborted as soon as the data was found not to be an image
+        } else if (reply->error() != QNetworkReply::NoError) {
+            qWarning() << Q_FUNC_INFO << "Failed to download image" << info->url << reply->errorString();
+        } else if (notModified) {
+            // the cached file is still current
+            info->file.remove();
+            success = true;
+        } else if (info->writeFailed) {
+            qWarning() << Q_FUNC_INFO << "Failed to store image" << info->url;
+        } else if (!info->validated && sniffImage(info->header) != ImageSignatureFound) {
+            // too short to be an image
+        } else if (!storeFile(partialName, info->fileName, d->contentAddressed
+                              ? makeContentFile(QString::fromLatin1(info->contentHash.result().toHex()))
+                              : QString())) {
+            qWarning() << Q_FUNC_INFO << "Failed to move image into place" << info->fileName;
+        } else {
+            QFile::remove(validatorFileName(info->fileName));
+            success = true;
+        }
+
+        // A 304 carries no body, and an invalid response says nothing
+        // about the host's capacity
+        d->downloadFinished(info, notModified || info->invalid
+                            ? AbstractImageDownloaderPrivate::DownloadNeutral
+                            : reply->error() == QNetworkReply::NoError
+                              ? AbstractImageDownloaderPrivate::DownloadSucceeded
+                              : AbstractImageDownloaderPrivate::DownloadFailed);
+
+        if (success) {
+            QVariantMap dbMetadata = info->requestsData.first();
+            dbMetadata.insert(QLatin1String(NOT_MODIFIED_KEY), notModified);
+            if (!notModified) {
+                dbMetadata.remove(QLatin1String(ETAG_KEY));
+                dbMetadata.remove(QLatin1String(LAST_MODIFIED_KEY));
+            }
+            if (d->contentAddressed && !notModified) {
+                dbMetadata.insert(QLatin1String(CONTENT_HASH_KEY),
+                                  QString::fromLatin1(info->contentHash.result().toHex()));
+            }
+            if (reply->hasRawHeader("ETag")) {
+                dbMetadata.insert(QLatin1String(ETAG_KEY), reply->rawHeader("ETag"));
+            }
+            if (reply->hasRawHeader("Last-Modified")) {
+                dbMetadata.insert(QLatin1String(LAST_MODIFIED_KEY), reply->rawHeader("Last-Modified"));
+            }
+
+            if (notModified) {
+                d->cacheRevalidated++;
+            } else {
+                d->cacheDownloaded++;
+            }
+
+            dbQueueImage(info->url, dbMetadata, info->fileName);
+            if (!notModified && !d->thumbnailSizes.isEmpty()) {
+                d->createThumbnails(info->url, info->fileName, dbMetadata);
+            }
             Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
-                emit imageDownloaded(info->url, fileName, metadata);
+                emit imageDownloaded(info->url, info->fileName, metadata);
             }
         } else {
-            // the file is not in image format.
-            info->file.remove(fileName); // remove artifacts.
+            if (!keepPartial(info, reply)) {
+                discardPartial(info->fileName); // remove artifacts.
+            }
             Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
                 emit imageDownloaded(info->url, QString(), metadata);
             }
         }
 
-        delete info;
+        d->finish(info);
 
         d->loadedCount ++;
         d->manageStack();
 
         if (d->loadedCount > MAX_BATCH_SAVE
-            || (d->runningReplies.isEmpty() && d->stack.isEmpty())) {
+            || (d->runningReplies.isEmpty() && d->queuedCount == 0)) {
             dbWrite();
             d->loadedCount = 0;
         }
+
+        if (d->runningReplies.isEmpty() && d->queuedCount == 0) {
+            d->scheduleCacheStatistics();
+        }
     }
 }
 
-void AbstractImageDownloader::timedOut()
+void AbstractImageDownloader::timedOut(QObject *object)
 {
     Q_D(AbstractImageDownloader);
 
-    QTimer *timer = qobject_cast<QTimer*>(sender());
-    if (timer) {
-        QNetworkReply *reply = d->replyTimeouts.take(timer);
-        if (reply) {
-            reply->deleteLater();
-            timer->deleteLater();
-            ImageInfo *info = d->runningReplies.take(reply);
-            qWarning() << Q_FUNC_INFO << "Image download request timed out";
-            Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
-                emit imageDownloaded(info->url, QString(), metadata);
-            }
+    QNetworkReply *reply = static_cast<QNetworkReply *>(object);
+    ImageInfo *info = d->runningReplies.take(reply);
+    if (info) {
+        if (!info->invalid) {
+            readData(info, reply);
+        }
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+        qWarning() << Q_FUNC_INFO << "Image download request timed out";
+
+        info->file.close();
+        d->downloadFinished(info, AbstractImageDownloaderPrivate::DownloadFailed);
+        if (!keepPartial(info, reply)) {
+            discardPartial(info->fileName);
         }
+        Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
+            emit imageDownloaded(info->url, QString(), metadata);
+        }
+        d->finish(info);
     }
 
     d->manageStack();
@@ -222,6 +752,8 @@ AbstractImageDownloader::AbstractImageDownloader(QObject *parent)
 {
     Q_D(AbstractImageDownloader);
     d->networkAccessManager = new QNetworkAccessManager(this);
+    d->replyTimeouts = new TimeoutWheel(1000, this);
+    connect(d->replyTimeouts, SIGNAL(timeout(QObject*)), this, SLOT(timedOut(QObject*)));
 }
 
 AbstractImageDownloader::AbstractImageDownloader(AbstractImageDownloaderPrivate &dd, QObject *parent)
@@ -229,15 +761,89 @@ AbstractImageDownloader::AbstractImageDownloader(AbstractImageDownloaderPrivate
 {
     Q_D(AbstractImageDownloader);
     d->networkAccessManager = new QNetworkAccessManager(this);
+    d->replyTimeouts = new TimeoutWheel(1000, this);
+    connect(d->replyTimeouts, SIGNAL(timeout(QObject*)), this, SLOT(timedOut(QObject*)));
 }
 
 AbstractImageDownloader::~AbstractImageDownloader()
 {
+    Q_D(AbstractImageDownloader);
+    if (d->workerThread) {
+        qWarning() << Q_FUNC_INFO << "Image downloader deleted without stopping its worker thread";
+    }
+    QMutexLocker locker(&d->thumbnailSink->mutex);
+    d->thumbnailSink->downloader = 0;
+}
+
+void AbstractImageDownloader::startWorkerThread()
+{
+    Q_D(AbstractImageDownloader);
+    if (d->workerThread) {
+        return;
+    }
+
+    d->workerThread = new QThread;
+    d->workerThread->setObjectName(QStringLiteral("ImageDownloader"));
+    moveToThread(d->workerThread);
+    d->workerThread->start(QThread::LowPriority);
+}
+
+void AbstractImageDownloader::stopWorkerThread()
+{
+    Q_D(AbstractImageDownloader);
+    if (!d->workerThread) {
+        return;
+    }
+
+    // Only the worker can hand the downloader back; downloads in flight
+    // are abandoned there first, as replies can't change threads.
+    QMetaObject::invokeMethod(this, "returnToThread", Qt::BlockingQueuedConnection,
+                              Q_ARG(QThread *, QThread::currentThread()));
+    d->workerThread->quit();
+    d->workerThread->wait();
+    delete d->workerThread;
+    d->workerThread = 0;
+}
+
+void AbstractImageDownloader::returnToThread(QThread *thread)
+{
+    Q_D(AbstractImageDownloader);
+
+    // Runs in the worker thread. Running downloads are aborted and reported
+    // as failed, keeping what can be resumed; queued ones start once more
+    // requests come in from the new thread.
+    const QList<QNetworkReply *> replies = d->runningReplies.keys();
+    Q_FOREACH (QNetworkReply *reply, replies) {
+        ImageInfo *info = d->runningReplies.take(reply);
+        d->replyTimeouts->stop(reply);
+        reply->disconnect(this);
+        reply->abort();
+
+        info->file.close();
+        d->downloadFinished(info, AbstractImageDownloaderPrivate::DownloadNeutral);
+        if (!keepPartial(info, reply)) {
+            discardPartial(info->fileName);
+        }
+        delete reply;
+
+        Q_FOREACH (const QVariantMap &metadata, info->requestsData) {
+            emit imageDownloaded(info->url, QString(), metadata);
+        }
+        d->finish(info);
+    }
+
+    moveToThread(thread);
 }
 
 void AbstractImageDownloader::queue(const QString &url, const QVariantMap &metadata)
 {
     Q_D(AbstractImageDownloader);
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queue", Qt::QueuedConnection,
+                                  Q_ARG(QString, url), Q_ARG(QVariantMap, metadata));
+        return;
+    }
+
     if (!dbInit()) {
         qWarning() << Q_FUNC_INFO << "Cannot perform operation, database is not initialized";
         emit imageDownloaded(url, QString(), metadata); // empty file signifies error.
@@ -245,29 +851,112 @@ void AbstractImageDownloader::queue(const QString &url, const QVariantMap &metad
     }
 
 
-    Q_FOREACH (ImageInfo *info, d->runningReplies) {
-        if (info->url == url) {
-            qWarning() << Q_FUNC_INFO << "duplicate running request, appending metadata.";
-            info->requestsData.append(metadata);
+    const QDateTime expires = metadata.value(QLatin1String(EXPIRES_KEY)).toDateTime();
+    if (expires.isValid() && expires > QDateTime::currentDateTime()) {
+        const QString cachedFile = outputFile(url, metadata);
+        if (!cachedFile.isEmpty() && QFile::exists(cachedFile)) {
+            d->cacheHits++;
+            emit imageDownloaded(url, cachedFile, metadata);
+            if (d->runningReplies.isEmpty() && d->queuedCount == 0) {
+                d->scheduleCacheStatistics();
+            }
             return;
         }
     }
 
-    ImageInfo *info = 0;
-    for (int i = 0; i < d->stack.count(); ++i) {
-        if (d->stack.at(i)->url == url) {
-            qWarning() << Q_FUNC_INFO << "duplicate queued request, appending metadata.";
-            info = d->stack.takeAt(i);
-            info->requestsData.append(metadata);
-            break;
+    const int priority = metadata.value(QLatin1String(PRIORITY_KEY), ThumbnailPriority).toInt();
+
+    ImageInfo *info = d->images.value(url);
+    if (info) {
+        info->requestsData.append(metadata);
+
+        // A queued duplicate may ask for the image sooner than the original did
+        if (priority > info->priority) {
+            QMap<int, QList<ImageInfo *> > &queuedImages = d->hosts[info->host].queuedImages;
+            QMap<int, QList<ImageInfo *> >::iterator queued = queuedImages.find(info->priority);
+            if (queued != queuedImages.end() && queued->removeOne(info)) {
+                if (queued->isEmpty()) {
+                    queuedImages.erase(queued);
+                }
+                --d->queuedCount;
+                info->priority = priority;
+                d->enqueue(info);
+            }
         }
+        return;
     }
 
-    if (!info) {
-        info = new ImageInfo(url, metadata);
+    info = new ImageInfo(url, metadata, priority);
+    d->images.insert(url, info);
+    d->enqueue(info);
+    d->manageStack();
+}
+
+void AbstractImageDownloader::reportCacheStatistics()
+{
+    Q_D(AbstractImageDownloader);
+
+    d->cacheStatisticsPending = false;
+    if (d->cacheHits == 0 && d->cacheRevalidated == 0 && d->cacheDownloaded == 0) {
+        return;
+    }
+
+    const int hits = d->cacheHits;
+    const int revalidated = d->cacheRevalidated;
+    const int downloaded = d->cacheDownloaded;
+    d->cacheHits = 0;
+    d->cacheRevalidated = 0;
+    d->cacheDownloaded = 0;
+
+    emit cacheStatistics(hits, revalidated, downloaded);
+}
+
+void AbstractImageDownloader::thumbnailsCreated(const QString &url, const QVariantMap &metadata,
+                                                const QVariantMap &thumbnailFiles)
+{
+    Q_D(AbstractImageDownloader);
+
+    --d->pendingThumbnails;
+    if (!thumbnailFiles.isEmpty()) {
+        QMap<int, QString> files;
+        for (QVariantMap::const_iterator it = thumbnailFiles.constBegin(); it != thumbnailFiles.constEnd(); ++it) {
+            files.insert(it.key().toInt(), it.value().toString());
+        }
+        dbQueueThumbnails(url, metadata, files);
+    }
+
+    if (d->pendingThumbnails == 0 && d->runningReplies.isEmpty() && d->queuedCount == 0) {
+        dbWrite();
+    }
+}
+
+void AbstractImageDownloader::setConditionalHeaders(QNetworkRequest *request, const QVariantMap &metadata)
+{
+    const QByteArray etag = metadata.value(QLatin1String(ETAG_KEY)).toByteArray();
+    if (!etag.isEmpty()) {
+        request->setRawHeader("If-None-Match", etag);
+    }
+    const QByteArray lastModified = metadata.value(QLatin1String(LAST_MODIFIED_KEY)).toByteArray();
+    if (!lastModified.isEmpty()) {
+        request->setRawHeader("If-Modified-Since", lastModified);
+    }
+    const qint64 resumeOffset = metadata.value(QLatin1String(RESUME_OFFSET_KEY)).toLongLong();
+    if (resumeOffset > 0) {
+        request->setRawHeader("Range", "bytes=" + QByteArray::number(resumeOffset) + '-');
+        request->setRawHeader("If-Range", metadata.value(QLatin1String(RESUME_VALIDATOR_KEY)).toByteArray());
+    }
+}
+
+void AbstractImageDownloader::setDownloadLimits(int maximumDownloads, int maximumHostDownloads)
+{
+    Q_D(AbstractImageDownloader);
+    d->maximumDownloads = qMax(1, maximumDownloads);
+    d->maximumHostDownloads = qBound(1, maximumHostDownloads, d->maximumDownloads);
+
+    for (QHash<QString, AbstractImageDownloaderPrivate::Host>::iterator it = d->hosts.begin(); it != d->hosts.end(); ++it) {
+        it->window = qMin<qreal>(it->window, d->maximumHostDownloads);
     }
 
-    d->stack.append(info);
     d->manageStack();
 }
 
@@ -283,6 +972,7 @@ QNetworkReply *AbstractImageDownloader::createReply(const QString &url, const QV
             break;
         }
     }
+    setConditionalHeaders(&request, metadata);
 
     qWarning() << "AbstractImageDownloader::about to fetch image:" << url;
     return d->networkAccessManager->get(request);
@@ -359,6 +1049,45 @@ QString AbstractImageDownloader::makeOutputFile(SocialSyncInterface::SocialNetwo
     return path;
 }
 
+QString AbstractImageDownloader::makeContentFile(const QString &contentHash)
+{
+    if (contentHash.length() < 2) {
+        return QString();
+    }
+
+    return QStringLiteral("%1/%2/%3/%4").arg(PRIVILEGED_DATA_DIR,
+                                             QStringLiteral(".content"),
+                                             contentHash.left(2),
+                                             contentHash);
+}
+
+QString AbstractImageDownloader::makeThumbnailFile(const QString &imageFile, int size)
+{
+    const QFileInfo fileInfo(imageFile);
+    return QStringLiteral("%1/%2/%3/%4").arg(fileInfo.absolutePath(),
+                                             QStringLiteral(".thumbnails"),
+                                             QString::number(size),
+                                             fileInfo.fileName());
+}
+
+void AbstractImageDownloader::setContentAddressed(bool enabled)
+{
+    Q_D(AbstractImageDownloader);
+    d->contentAddressed = enabled;
+}
+
+void AbstractImageDownloader::setThumbnailSizes(const QList<int> &sizes)
+{
+    Q_D(AbstractImageDownloader);
+    d->thumbnailSizes.clear();
+    Q_FOREACH (int size, sizes) {
+        if (size > 0 && !d->thumbnailSizes.contains(size)) {
+            d->thumbnailSizes.append(size);
+        }
+    }
+    std::sort(d->thumbnailSizes.begin(), d->thumbnailSizes.end(), std::greater<int>());
+}
+
 bool AbstractImageDownloader::dbInit()
 {
     return true;
@@ -372,6 +1101,14 @@ void AbstractImageDownloader::dbQueueImage(const QString &url, const QVariantMap
     Q_UNUSED(file)
 }
 
+void AbstractImageDownloader::dbQueueThumbnails(const QString &url, const QVariantMap &metadata,
+                                                const QMap<int, QString> &thumbnailFiles)
+{
+    Q_UNUSED(url)
+    Q_UNUSED(metadata)
+    Q_UNUSED(thumbnailFiles)
+}
+
 void AbstractImageDownloader::dbWrite()
 {
 }
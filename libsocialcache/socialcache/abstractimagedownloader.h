@@ -25,20 +25,60 @@
 #include <QtCore/QVariantMap>
 
 class QNetworkReply;
+class QNetworkRequest;
+class QThread;
 class AbstractImageDownloaderPrivate;
 class AbstractImageDownloader : public QObject
 {
     Q_OBJECT
 public:
+    // Queued requests are served highest priority first, in queueing order
+    // within a priority. Pass one of these under the "priority" metadata key.
+    enum Priority {
+        FullSizePriority = 0,
+        ThumbnailPriority,  // default
+        VisiblePriority
+    };
+
+    // A request whose metadata carries the "expires" time of an existing cached
+    // copy is answered from the cache until then. Once expired, its "etag" and
+    // "lastModified" validators make the download conditional: if the server
+    // answers 304 the cached file is kept, and dbQueueImage() sees the metadata
+    // with "notModified" set. dbQueueImage() always receives the current
+    // validators under the same keys, so they can be stored with the image.
+
     AbstractImageDownloader(QObject *parent = 0);
     virtual ~AbstractImageDownloader();
 
+    // Shared copy of the image content with the given hash. With content
+    // addressing every output file is a hard link to one of these, so identical
+    // images downloaded for several accounts or services are stored once.
+    // dbQueueImage() metadata carries the hash of downloaded content as
+    // "contentHash"; it is absent when a 304 kept the existing file.
+    static QString makeContentFile(const QString &contentHash);
+
+    // Pre-scaled copy of an image file, fitting in size x size pixels
+    static QString makeThumbnailFile(const QString &imageFile, int size);
+
+    // Moves the downloader, with its network access manager, to a low priority
+    // thread of its own, so downloads and file writes stay off the caller's
+    // thread. queue() may then be called from any thread, and signals reach
+    // receivers in other threads queued. Call stopWorkerThread() from the
+    // thread that will delete the downloader before deleting it; downloads
+    // still running then are abandoned and reported as failed.
+    void startWorkerThread();
+    void stopWorkerThread();
+
 public Q_SLOTS:
     void queue(const QString &url, const QVariantMap &data);
 
 Q_SIGNALS:
     void imageDownloaded(const QString &url, const QString &path, const QVariantMap &metadata);
 
+    // Emitted once the queue drains: requests answered from the cache,
+    // revalidated with a 304, and downloaded in full since the last report.
+    void cacheStatistics(int hits, int revalidated, int downloaded);
+
 protected:
     explicit AbstractImageDownloader(AbstractImageDownloaderPrivate &dd, QObject *parent);
 
@@ -50,8 +90,27 @@ protected:
                                   const QString &identifier,
                                   const QString &remoteUrl); // added to retain BC.
 
+    // When enabled, output files are hard links to a shared copy of their
+    // content, see makeContentFile().
+    void setContentAddressed(bool enabled);
+
+    // Edge lengths of the thumbnails to create for each downloaded image, so
+    // image lists never have to decode full size files. Thumbnails are scaled
+    // on a shared pool of at most one thread per core and reported through
+    // dbQueueThumbnails(). None are created by default.
+    void setThumbnailSizes(const QList<int> &sizes);
+
     virtual QNetworkReply * createReply(const QString &url, const QVariantMap &metadata);
 
+    // Adds the conditional request headers for the validators in metadata,
+    // and the range request resuming an interrupted download;
+    // createReply() implementations should call this on their request.
+    static void setConditionalHeaders(QNetworkRequest *request, const QVariantMap &metadata);
+
+    // Caps on downloads in flight, overall and to a single host. Within these
+    // the number of parallel downloads to a host adapts to its responsiveness.
+    void setDownloadLimits(int maximumDownloads, int maximumHostDownloads);
+
     // Output file based on passed data
     virtual QString outputFile(const QString &url, const QVariantMap &metadata) const = 0;
 
@@ -63,6 +122,10 @@ protected:
     virtual void dbQueueImage(const QString &url, const QVariantMap &metadata,
                               const QString &file);
 
+    // Queue the thumbnails created for a downloaded image, by size
+    virtual void dbQueueThumbnails(const QString &url, const QVariantMap &metadata,
+                                   const QMap<int, QString> &thumbnailFiles);
+
     // Write in the database
     virtual void dbWrite();
 
@@ -71,7 +134,11 @@ protected:
 private Q_SLOTS:
     void readyRead();
     void slotFinished();
-    void timedOut();
+    void timedOut(QObject *reply);
+    void reportCacheStatistics();
+    void returnToThread(QThread *thread);
+    void thumbnailsCreated(const QString &url, const QVariantMap &metadata,
+                           const QVariantMap &thumbnailFiles);
 
 private:
     Q_DECLARE_PRIVATE(AbstractImageDownloader)
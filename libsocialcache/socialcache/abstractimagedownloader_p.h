@@ -33,25 +33,56 @@
 #define ABSTRACTIMAGEDOWNLOADER_P_H
 
 #include <QtCore/QObject>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
+#include <QtCore/QHash>
 #include <QtCore/QMap>
+#include <QtCore/QMutex>
 #include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QVariantMap>
-#include <QtCore/QTimer>
 #include <QtNetwork/QNetworkAccessManager>
 
+#include "timeoutwheel.h"
+
 struct ImageInfo
 {
-    ImageInfo(const QString &url, const QVariantMap &data) : url(url), requestsData(QList<QVariantMap>() << data) {}
+    ImageInfo(const QString &url, const QVariantMap &data, int priority) : url(url), priority(priority), sequence(0), latency(-1), resumeOffset(0), writeFailed(false), validated(false), invalid(false), conditional(false), contentHash(QCryptographicHash::Sha1), requestsData(QList<QVariantMap>() << data) {}
 
     QString url;
-    QFile file;
+    QString host;       // host the request is (or will be) sent to
+    int priority;
+    quint64 sequence;   // queueing order, to keep FIFO across hosts
+    QElapsedTimer elapsed;
+    qint64 latency;     // msecs until the first data arrived, -1 until it does
+    QString fileName;   // final location, only created once the download succeeds
+    QFile file;         // partial download, renamed to fileName on success
+    qint64 resumeOffset;        // bytes kept from an earlier attempt
+    QByteArray resumeValidator; // ETag or Last-Modified the kept bytes belong to
+    bool writeFailed;
+    bool validated;     // the content type and first bytes have been checked
+    bool invalid;       // the response is not an image, the download is aborted
+    QByteArray header;  // first bytes, kept until they can be validated
+    bool conditional;   // validators were sent for an existing cached file
+    QCryptographicHash contentHash;
     QString redirectUrl;
     QList<QVariantMap> requestsData;
 };
 
 
 class AbstractImageDownloader;
+
+// Lets thumbnail jobs still running on the pool find out whether the
+// downloader they report to has gone away.
+struct ThumbnailSink
+{
+    explicit ThumbnailSink(AbstractImageDownloader *downloader) : downloader(downloader) {}
+
+    QMutex mutex;
+    AbstractImageDownloader *downloader;
+};
+
 class AbstractImageDownloaderPrivate
 {
 public:
@@ -63,10 +94,49 @@ protected:
 
 private:
     void manageStack();
+    void enqueue(ImageInfo *info);
+    void finish(ImageInfo *info);
+    enum DownloadOutcome {
+        DownloadSucceeded,
+        DownloadFailed,
+        DownloadNeutral     // tells nothing about the host, only frees the slot
+    };
+    void downloadFinished(ImageInfo *info, DownloadOutcome outcome);
+    void scheduleCacheStatistics();
+    void createThumbnails(const QString &url, const QString &imageFile, const QVariantMap &metadata);
+
+    // Downloads in flight to one host are limited by an AIMD window: it
+    // grows by one per window's worth of successful downloads, and halves
+    // on failures or when the time to the first byte rises well above its
+    // running average. Unlike throughput, that doesn't depend on image size.
+    struct Host
+    {
+        Host() : window(0), running(0), latency(0) {}
+
+        qreal window;
+        int running;
+        qreal latency;      // smoothed, in milliseconds
+        QMap<int, QList<ImageInfo *> > queuedImages; // by priority, FIFO within one
+    };
+
     QMap<QNetworkReply *, ImageInfo *> runningReplies;
-    QMap<QTimer *, QNetworkReply *> replyTimeouts;
-    QList<ImageInfo *> stack;
+    TimeoutWheel *replyTimeouts;
+    QHash<QString, ImageInfo *> images;         // queued and running, by url
+    QHash<QString, Host> hosts;
+    int queuedCount;
+    quint64 nextSequence;
+    int maximumDownloads;
+    int maximumHostDownloads;
     int loadedCount;
+    int cacheHits;
+    int cacheRevalidated;
+    int cacheDownloaded;
+    bool cacheStatisticsPending;
+    bool contentAddressed;
+    QList<int> thumbnailSizes;      // largest first
+    int pendingThumbnails;
+    QSharedPointer<ThumbnailSink> thumbnailSink;
+    QThread *workerThread;
     Q_DECLARE_PUBLIC(AbstractImageDownloader)
 };
 
@@ -20,8 +20,10 @@
 #include "abstractsocialcachedatabase.h"
 #include "abstractsocialcachedatabase_p.h"
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QEvent>
 #include <QtCore/QFile>
 #include <QtCore/QStandardPaths>
@@ -45,7 +47,38 @@
 
 QThreadStorage<QHash<QString, AbstractSocialCacheDatabasePrivate::ThreadData> > AbstractSocialCacheDatabasePrivate::globalThreadData;
 
+static const int DEFAULT_WORKER_POOL_SIZE = 2;
+static const int DEFAULT_WRITE_LOCK_TIMEOUT = 30000;
+
+static QAtomicInt writeLockTimeoutMs(DEFAULT_WRITE_LOCK_TIMEOUT);
+
 namespace {
+class WorkerPools
+{
+public:
+    WorkerPools() : size(DEFAULT_WORKER_POOL_SIZE) {}
+    ~WorkerPools() { qDeleteAll(pools); }
+
+    AbstractSocialCacheDatabaseWorkerPool *pool(const QString &filePath)
+    {
+        QMutexLocker locker(&mutex);
+
+        AbstractSocialCacheDatabaseWorkerPool *&pool = pools[filePath];
+        if (!pool) {
+            pool = new AbstractSocialCacheDatabaseWorkerPool;
+            pool->readThreadPool.setMaxThreadCount(size);
+            pool->writeThreadPool.setMaxThreadCount(size);
+        }
+        return pool;
+    }
+
+    QMutex mutex;
+    QHash<QString, AbstractSocialCacheDatabaseWorkerPool *> pools;
+    int size;
+};
+
+Q_GLOBAL_STATIC(WorkerPools, workerPools)
+
 class ProcessMutexCleanup
 {
 public:
@@ -72,6 +105,25 @@ public:
 private:
     AbstractSocialCacheDatabasePrivate::ThreadData *threadData;
 };
+
+int userVersion(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QLatin1String("PRAGMA user_version")) || !query.next()) {
+        return -1;
+    }
+    return query.value(0).toInt();
+}
+}
+
+AbstractSocialCacheDatabaseWorkerPool::AbstractSocialCacheDatabaseWorkerPool()
+{
+    readThreadPool.setExpiryTimeout(-1);
+    writeThreadPool.setExpiryTimeout(-1);
+
+    statistics.connectionsOpened = 0;
+    statistics.connectionsReused = 0;
+    statistics.initializationTime = 0;
 }
 
 AbstractSocialCacheDatabasePrivate::AbstractSocialCacheDatabasePrivate(
@@ -85,13 +137,16 @@ AbstractSocialCacheDatabasePrivate::AbstractSocialCacheDatabasePrivate(
     , dataType(dataType)
     , filePath(QString(QLatin1String("%1/%2/%3")).arg(PRIVILEGED_DATA_DIR, dataType, databaseFile))
     , version(version)
+    , workerPool(workerPools()->pool(filePath))
     , readStatus(AbstractSocialCacheDatabase::Null)
     , writeStatus(AbstractSocialCacheDatabase::Null)
     , asyncReadStatus(Null)
     , asyncWriteStatus(Null)
-    , running(false)
+    , readWorker(this, false)
+    , writeWorker(this, true)
+    , readRunning(false)
+    , writeRunning(false)
 {
-    setAutoDelete(false);
 }
 
 AbstractSocialCacheDatabasePrivate::~AbstractSocialCacheDatabasePrivate()
@@ -108,8 +163,28 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
     const QString connectionName = QString(QLatin1String("socialcache/%1/%2/%3")).arg(
                 serviceName, dataType, uuid.toString());
 
-    threadData->mutex = new ProcessMutex(connectionName);
-    if (!threadData->mutex->lock()) {
+    // The lock file lives next to the database, so its directory must exist first
+    QFileInfo fileInfo(filePath);
+    if (!fileInfo.dir().exists()) {
+        fileInfo.dir().mkpath(QStringLiteral("."));
+    }
+
+    threadData->mutex = new ProcessMutex(filePath + QLatin1String(".lock"));
+
+    // The write lock is only needed to create or upgrade the schema. A
+    // database which is already current is opened without waiting for a
+    // writer, which may hold the lock for a long transaction.
+    if (fileInfo.exists()) {
+        threadData->database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        threadData->database.setDatabaseName(filePath);
+        if (threadData->database.open() && userVersion(threadData->database) == version) {
+            QSqlQuery query(threadData->database);
+            query.exec(QStringLiteral("PRAGMA temp_store = MEMORY;"));
+            return true;
+        }
+    }
+
+    if (!threadData->mutex->lock(writeLockTimeoutMs.load())) {
         qWarning() << Q_FUNC_INFO << "Error: unable to acquire mutex lock during database initialisation";
         delete threadData->mutex;
         threadData->mutex = 0;
@@ -120,14 +195,9 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
 
     bool createTables = false;
 
-    QFileInfo fileInfo(filePath);
-    if (!fileInfo.exists()) {
+    if (!QFile::exists(filePath)) {
         createTables = true;
 
-        QDir dir = fileInfo.dir();
-        if (!dir.exists()) {
-            dir.mkpath(".");
-        }
         QFile dbfile(filePath);
         if (!dbfile.open(QIODevice::ReadWrite)) {
             qWarning() << Q_FUNC_INFO << "Unable to create database" << filePath << "Service"
@@ -138,10 +208,12 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
     }
 
     // open the database in which we store our synced image information
-    threadData->database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
-    threadData->database.setDatabaseName(filePath);
+    if (!threadData->database.isValid()) {
+        threadData->database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        threadData->database.setDatabaseName(filePath);
+    }
 
-    if (!threadData->database.open()) {
+    if (!threadData->database.isOpen() && !threadData->database.open()) {
         qWarning() << Q_FUNC_INFO << "Unable to open database" << filePath << "Service"
                    << serviceName << "with data type" << dataType << "will be inactive";
         return false;
@@ -164,16 +236,21 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
     query.finish();
 
     if (databaseVersion < version) {
-        createTables = true;
         qWarning() << Q_FUNC_INFO << "Version required is" << version
                    << "while database is using" << databaseVersion;
 
-        // DB needs to be recreated
-        if (!q->dropTables(threadData->database)) {
-            qWarning() << Q_FUNC_INFO << "Failed to update database" << filePath
-                       << "It is probably broken and need to be removed manually";
-            threadData->database.close();
-            return false;
+        // Try to upgrade the schema in place, and only recreate
+        // the DB if there is no upgrade path from its version.
+        if (createTables || databaseVersion <= 0
+                || !upgradeDatabase(threadData->database, databaseVersion)) {
+            createTables = true;
+
+            if (!q->dropTables(threadData->database)) {
+                qWarning() << Q_FUNC_INFO << "Failed to update database" << filePath
+                           << "It is probably broken and need to be removed manually";
+                threadData->database.close();
+                return false;
+            }
         }
     }
 
@@ -197,44 +274,145 @@ bool AbstractSocialCacheDatabasePrivate::initializeThreadData(ThreadData *thread
     return true;
 }
 
-void AbstractSocialCacheDatabasePrivate::run()
+bool AbstractSocialCacheDatabasePrivate::upgradeDatabase(QSqlDatabase database, int fromVersion) const
+{
+    Q_Q(const AbstractSocialCacheDatabase);
+
+    if (!database.transaction()) {
+        qWarning() << Q_FUNC_INFO << "Failed to start a database transaction" << database.lastError();
+        return false;
+    }
+
+    for (int currentVersion = fromVersion; currentVersion < version; ++currentVersion) {
+        if (!q->upgradeTables(database, currentVersion)) {
+            qWarning() << Q_FUNC_INFO << "No upgrade path for database" << filePath
+                       << "from version" << currentVersion << "to" << currentVersion + 1;
+            database.rollback();
+            return false;
+        }
+    }
+
+    QSqlQuery query(database);
+    if (!query.exec(QString(QLatin1String("PRAGMA user_version=%1")).arg(version))) {
+        qWarning() << Q_FUNC_INFO << "Failed to set database version" << filePath
+                   << query.lastError();
+        query.finish();
+        database.rollback();
+        return false;
+    }
+    query.finish();
+
+    if (!database.commit()) {
+        qWarning() << Q_FUNC_INFO << "Failed to commit database upgrade" << filePath
+                   << database.lastError();
+        database.rollback();
+        return false;
+    }
+
+    return true;
+}
+
+bool AbstractSocialCacheDatabasePrivate::ensureThreadData(ThreadData *threadData) const
+{
+    if (threadData->mutex) {
+        return true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool initialized = initializeThreadData(threadData);
+
+    QMutexLocker locker(&workerPool->statisticsMutex);
+    workerPool->statistics.initializationTime += timer.elapsed();
+    if (initialized) {
+        workerPool->statistics.connectionsOpened += 1;
+    }
+
+    return initialized;
+}
+
+// Called by the workers once per job they pick up on an already open connection.
+void AbstractSocialCacheDatabasePrivate::connectionReused() const
+{
+    QMutexLocker locker(&workerPool->statisticsMutex);
+    workerPool->statistics.connectionsReused += 1;
+}
+
+// Runs on a worker thread, with its own connection. Since the database
+// is in WAL mode, reads see the last committed state and are not blocked
+// by a write running on another connection.
+void AbstractSocialCacheDatabasePrivate::runReads()
 {
     Q_Q(AbstractSocialCacheDatabase);
 
     ThreadData &threadData = globalThreadData.localData()[filePath];
-
-    if (!threadData.mutex && !initializeThreadData(&threadData)) {
-        return;
+    const bool reused = threadData.mutex != 0;
+    const bool initialized = ensureThreadData(&threadData);
+    if (reused) {
+        connectionReused();
     }
 
     QMutexLocker locker(&mutex);
-    for (;;) {
-        if (asyncWriteStatus == Queued) {
-            if (writeStatus == AbstractSocialCacheDatabase::Null) {
-                asyncWriteStatus = Null;
-                continue;
-            }
+    while (asyncReadStatus == Queued) {
+        if (readStatus == AbstractSocialCacheDatabase::Null) {
+            asyncReadStatus = Null;
+            break;
+        } else if (!initialized) {
+            asyncReadStatus = Error;
+            break;
+        }
 
-            asyncWriteStatus = Executing;
+        asyncReadStatus = Executing;
 
-            locker.unlock();
+        locker.unlock();
 
-            if (!threadData.mutex->lock()) {
-                // Warning
-                qWarning() << Q_FUNC_INFO << "Failed to acquire a lock on the database";
-                locker.relock();
-                break;
-            }
+        bool success = q->read();
 
-            if (!threadData.database.transaction()) {
-                qWarning() << Q_FUNC_INFO << "Failed to start a database transaction";
+        locker.relock();
 
-                threadData.mutex->unlock();
-                locker.relock();
-                break;
-            }
+        if (asyncReadStatus == Executing) {
+            asyncReadStatus = success ? Finished : Error;
+        }
+    }
+
+    readRunning = false;
+    workerFinished();
+}
+
+void AbstractSocialCacheDatabasePrivate::runWrites()
+{
+    Q_Q(AbstractSocialCacheDatabase);
 
-            bool success = q->write();
+    ThreadData &threadData = globalThreadData.localData()[filePath];
+    const bool reused = threadData.mutex != 0;
+    const bool initialized = ensureThreadData(&threadData);
+    if (reused) {
+        connectionReused();
+    }
+
+    QMutexLocker locker(&mutex);
+    while (asyncWriteStatus == Queued) {
+        if (writeStatus == AbstractSocialCacheDatabase::Null) {
+            asyncWriteStatus = Null;
+            break;
+        } else if (!initialized) {
+            asyncWriteStatus = Error;
+            break;
+        }
+
+        asyncWriteStatus = Executing;
+
+        locker.unlock();
+
+        bool success = false;
+        if (!threadData.mutex->lock(writeLockTimeoutMs.load())) {
+            qWarning() << Q_FUNC_INFO << "Failed to acquire a lock on the database";
+        } else if (!threadData.database.transaction()) {
+            qWarning() << Q_FUNC_INFO << "Failed to start a database transaction";
+            threadData.mutex->unlock();
+        } else {
+            success = q->write();
 
             if (!success) {
                 threadData.database.rollback();
@@ -242,37 +420,31 @@ void AbstractSocialCacheDatabasePrivate::run()
                 qWarning() << Q_FUNC_INFO << "Failed to commit a database transaction";
                 qWarning() << threadData.database.lastError();
                 success = false;
+            } else {
+                q->writeCommitted();
             }
 
             threadData.mutex->unlock();
-            locker.relock();
+        }
 
-            if (asyncWriteStatus == Executing) {
-                asyncWriteStatus = success ? Finished : Error;
-            }
-        } else if (asyncReadStatus == Queued) {
-            if (readStatus == AbstractSocialCacheDatabase::Null) {
-                asyncReadStatus = Null;
-                continue;
-            }
-            asyncReadStatus = Executing;
+        locker.relock();
 
-            locker.unlock();
+        if (asyncWriteStatus == Executing) {
+            asyncWriteStatus = success ? Finished : Error;
+        }
+    }
 
-            bool success = q->read();
+    writeRunning = false;
+    workerFinished();
+}
 
-            locker.relock();
+// Must be called with the mutex locked.
+void AbstractSocialCacheDatabasePrivate::workerFinished()
+{
+    Q_Q(AbstractSocialCacheDatabase);
 
-            if (asyncReadStatus == Executing) {
-                asyncReadStatus = success ? Finished : Error;
-            }
-        } else {
-            running = false;
-            QCoreApplication::postEvent(q, new QEvent(QEvent::UpdateRequest));
-            condition.wakeOne();
-            return;
-        }
-    }
+    QCoreApplication::postEvent(q, new QEvent(QEvent::UpdateRequest));
+    condition.wakeAll();
 }
 
 AbstractSocialCacheDatabase::AbstractSocialCacheDatabase(
@@ -375,9 +547,9 @@ void AbstractSocialCacheDatabase::executeRead()
     d->readStatus = Executing;
     d->asyncReadStatus = AbstractSocialCacheDatabasePrivate::Queued;
 
-    if (!d->running) {
-        d->running = true;
-        QThreadPool::globalInstance()->start(d);
+    if (!d->readRunning) {
+        d->readRunning = true;
+        d->workerPool->readThreadPool.start(&d->readWorker);
     }
 }
 
@@ -397,9 +569,9 @@ void AbstractSocialCacheDatabase::executeWrite()
     d->writeStatus = Executing;
     d->asyncWriteStatus = AbstractSocialCacheDatabasePrivate::Queued;
 
-    if (!d->running) {
-        d->running = true;
-        QThreadPool::globalInstance()->start(d);
+    if (!d->writeRunning) {
+        d->writeRunning = true;
+        d->workerPool->writeThreadPool.start(&d->writeWorker);
     }
 }
 
@@ -411,6 +583,18 @@ void AbstractSocialCacheDatabase::cancelWrite()
     d->writeStatus = Null;
 }
 
+// Upgrades the tables from fromVersion to fromVersion + 1, without
+// discarding the data they contain. Subclasses that bump their version
+// should reimplement this for every step they know how to migrate.
+// Returning false makes the database fall back to dropping and
+// recreating all tables.
+bool AbstractSocialCacheDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    Q_UNUSED(database)
+    Q_UNUSED(fromVersion)
+    return false;
+}
+
 bool AbstractSocialCacheDatabase::read()
 {
     return false;
@@ -429,6 +613,15 @@ void AbstractSocialCacheDatabase::writeFinished()
 {
 }
 
+// Called on the writer thread once the transaction of a successful write()
+// has been committed, while the lock on the database is still held. Work
+// that must not happen unless the write is kept, such as removing the
+// files of deleted rows, belongs here. Calling executeWrite() from here
+// runs write() again in a new transaction.
+void AbstractSocialCacheDatabase::writeCommitted()
+{
+}
+
 void AbstractSocialCacheDatabase::wait()
 {
     Q_D(AbstractSocialCacheDatabase);
@@ -438,7 +631,7 @@ void AbstractSocialCacheDatabase::wait()
 
     QMutexLocker locker(&d->mutex);
 
-    while (d->running) {
+    while (d->readRunning || d->writeRunning) {
         d->condition.wait(&d->mutex);
     }
 
@@ -467,13 +660,57 @@ void AbstractSocialCacheDatabase::wait()
     }
 }
 
+// Returns how many connections to this database file were opened and
+// reused, and how long opening them took, across all database objects
+// of this process.
+AbstractSocialCacheDatabase::ConnectionStatistics AbstractSocialCacheDatabase::connectionStatistics() const
+{
+    Q_D(const AbstractSocialCacheDatabase);
+
+    QMutexLocker locker(&d->workerPool->statisticsMutex);
+    return d->workerPool->statistics;
+}
+
+int AbstractSocialCacheDatabase::workerPoolSize()
+{
+    QMutexLocker locker(&workerPools()->mutex);
+    return workerPools()->size;
+}
+
+// Sets the number of worker threads, and so of warm connections, kept for
+// each database file. Reads and writes each get this many threads, so
+// writers can never take all threads away from readers.
+void AbstractSocialCacheDatabase::setWorkerPoolSize(int size)
+{
+    WorkerPools *pools = workerPools();
+
+    QMutexLocker locker(&pools->mutex);
+    pools->size = qMax(1, size);
+    Q_FOREACH (AbstractSocialCacheDatabaseWorkerPool *pool, pools->pools) {
+        pool->readThreadPool.setMaxThreadCount(pools->size);
+        pool->writeThreadPool.setMaxThreadCount(pools->size);
+    }
+}
+
+int AbstractSocialCacheDatabase::writeLockTimeout()
+{
+    return writeLockTimeoutMs.load();
+}
+
+// Sets how long a write waits for other writers of the same database, in
+// this or another process, before failing. A negative value waits forever.
+void AbstractSocialCacheDatabase::setWriteLockTimeout(int msecs)
+{
+    writeLockTimeoutMs.store(msecs);
+}
+
 QSqlQuery AbstractSocialCacheDatabase::prepare(const QString &query) const
 {
     Q_D(const AbstractSocialCacheDatabase);
 
     AbstractSocialCacheDatabasePrivate::ThreadData &threadData = AbstractSocialCacheDatabasePrivate::globalThreadData.localData()[d->filePath];
 
-    if (!threadData.mutex && ! d_func()->initializeThreadData(&threadData)) {
+    if (!d->ensureThreadData(&threadData)) {
         return QSqlQuery();
     }
 
@@ -41,6 +41,13 @@ public:
         Error
     };
 
+    struct ConnectionStatistics
+    {
+        int connectionsOpened;
+        int connectionsReused;
+        qint64 initializationTime; // in milliseconds
+    };
+
     explicit AbstractSocialCacheDatabase(
             const QString &serviceName,
             const QString &dataType,
@@ -57,6 +64,14 @@ public:
 
     void wait();
 
+    ConnectionStatistics connectionStatistics() const;
+
+    static int workerPoolSize();
+    static void setWorkerPoolSize(int size);
+
+    static int writeLockTimeout();
+    static void setWriteLockTimeout(int msecs);
+
 Q_SIGNALS:
     void readStatusChanged();
     void writeStatusChanged();
@@ -72,9 +87,11 @@ protected:
     virtual bool write();
     virtual bool createTables(QSqlDatabase database) const = 0;
     virtual bool dropTables(QSqlDatabase database) const = 0;
+    virtual bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
     virtual void readFinished();
     virtual void writeFinished();
+    virtual void writeCommitted();
 
 
     QSqlQuery prepare(const QString &query) const;
@@ -21,8 +21,10 @@
 #define ABSTRACTSOCIALCACHEDATABASE_P_H
 
 #include <QtCore/QtGlobal>
+#include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
 #include <QtCore/QThreadStorage>
 #include <QtCore/QWaitCondition>
 #include <QtSql/QSqlDatabase>
@@ -30,8 +32,23 @@
 #include "semaphore_p.h"
 #include "abstractsocialcachedatabase.h"
 
+// Worker threads shared by every database object that uses the same
+// database file. The threads never expire, so the connections they
+// hold in their ThreadData stay open between jobs. Reads have threads
+// of their own, so they are never queued behind writes.
+struct AbstractSocialCacheDatabaseWorkerPool
+{
+    AbstractSocialCacheDatabaseWorkerPool();
+
+    QThreadPool readThreadPool;
+    QThreadPool writeThreadPool;
+
+    QMutex statisticsMutex;
+    AbstractSocialCacheDatabase::ConnectionStatistics statistics;
+};
+
 class AbstractSocialCacheDatabase;
-class AbstractSocialCacheDatabasePrivate : public QRunnable
+class AbstractSocialCacheDatabasePrivate
 {
 protected:
     AbstractSocialCacheDatabase * const q_ptr;
@@ -66,6 +83,9 @@ public:
     virtual ~AbstractSocialCacheDatabasePrivate();
 
     bool initializeThreadData(ThreadData *threadData) const;
+    bool ensureThreadData(ThreadData *threadData) const;
+    void connectionReused() const;
+    bool upgradeDatabase(QSqlDatabase database, int fromVersion) const;
 
     static QThreadStorage<QHash<QString, ThreadData> > globalThreadData;
 
@@ -77,15 +97,39 @@ public:
     const QString filePath;
     const int version;
 
+    AbstractSocialCacheDatabaseWorkerPool * const workerPool;
+
     AbstractSocialCacheDatabase::Status readStatus;
     AbstractSocialCacheDatabase::Status writeStatus;
 
     Status asyncReadStatus;
     Status asyncWriteStatus;
 
-    bool running;
+    // Reads and writes are run by separate workers, so that they use
+    // separate connections and reads are not queued behind a long
+    // write transaction.
+    class Worker : public QRunnable
+    {
+    public:
+        Worker(AbstractSocialCacheDatabasePrivate *d, bool writer)
+            : d(d), writer(writer) { setAutoDelete(false); }
+
+        void run() { if (writer) d->runWrites(); else d->runReads(); }
+
+    private:
+        AbstractSocialCacheDatabasePrivate * const d;
+        const bool writer;
+    };
+
+    Worker readWorker;
+    Worker writeWorker;
+
+    bool readRunning;
+    bool writeRunning;
 
-    void run();
+    void runReads();
+    void runWrites();
+    void workerFinished();
 
 private:
 
@@ -20,7 +20,7 @@
 #include "abstractsocialcachedatabase_p.h"
 #include "socialsyncinterface.h"
 #include <QtCore/QDebug>
-#include <QtCore/QRunnable>
+#include <QtCore/QHash>
 #include <QtCore/QStringList>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
@@ -29,7 +29,10 @@ static const char *INVALID = "invalid";
 static const char *PHOTO = "photo";
 static const char *VIDEO = "video";
 
-static const int POST_DB_VERSION = 1;
+static const int POST_DB_VERSION = 3;
+
+// Number of write generations kept in the post_changes log.
+static const int MAX_CHANGE_GENERATIONS = 100;
 
 struct SocialPostImagePrivate
 {
@@ -207,6 +210,29 @@ class AbstractSocialPostCacheDatabasePrivate: public AbstractSocialCacheDatabase
 public:
     AbstractSocialPostCacheDatabasePrivate(
             AbstractSocialPostCacheDatabase *q, const QString &serviceName, const QString &databaseFile);
+
+    // Keyset of the page requested by fetchMore(). A pageSize of 0
+    // means that every post is read at once. When changes is set, only
+    // the posts changed after sinceGeneration are read.
+    struct Window {
+        int pageSize;
+        bool fetchMore;
+        uint timestamp;
+        QString identifier;
+        bool changes;
+        int sinceGeneration;
+    };
+
+    struct ReadResult {
+        QList<SocialPost::ConstPtr> posts;
+        QStringList removedPosts;
+        bool canFetchMore;
+        bool changesComplete;
+        int generation;
+    };
+
+    bool readWindow(const Window &window, ReadResult *result);
+
 private:
     struct {
         QMap<QString, SocialPost::ConstPtr> insertPosts;
@@ -216,10 +242,31 @@ private:
         bool removeAll;
     } queue;
 
-    QList<SocialPost::ConstPtr> asyncPosts;
+    // refresh() and fetchMore() request posts, queryChanges() requests
+    // the delta. Both can be pending at once, and are read by the same job.
+    Window window;
+    bool postsRequested;
+    bool changesRequested;
+    int changesSinceGeneration;
+
+    ReadResult asyncPosts;
+    ReadResult asyncChanges;
+    bool asyncFetchMore;
+    bool asyncPostsRead;
+    bool asyncChangesRead;
+
     QList<SocialPost::ConstPtr> posts;
+    bool canFetchMore;
+    int generation;
     QVariantList accountIdFilter;
 
+    struct {
+        QList<SocialPost::ConstPtr> posts;
+        QStringList removedPosts;
+        int generation;
+        bool complete;
+    } changes;
+
     Q_DECLARE_PUBLIC(AbstractSocialPostCacheDatabase)
 };
 
@@ -231,8 +278,30 @@ AbstractSocialPostCacheDatabasePrivate::AbstractSocialPostCacheDatabasePrivate(
             SocialSyncInterface::dataType(SocialSyncInterface::Posts),
             databaseFile,
             POST_DB_VERSION)
+    , postsRequested(false)
+    , changesRequested(false)
+    , changesSinceGeneration(0)
+    , asyncFetchMore(false)
+    , asyncPostsRead(false)
+    , asyncChangesRead(false)
+    , canFetchMore(false)
+    , generation(0)
 {
     queue.removeAll = false;
+
+    window.pageSize = 0;
+    window.fetchMore = false;
+    window.timestamp = 0;
+    window.changes = false;
+    window.sinceGeneration = 0;
+
+    asyncPosts.canFetchMore = false;
+    asyncPosts.changesComplete = true;
+    asyncPosts.generation = 0;
+    asyncChanges = asyncPosts;
+
+    changes.generation = 0;
+    changes.complete = false;
 }
 
 AbstractSocialPostCacheDatabase::~AbstractSocialPostCacheDatabase()
@@ -261,11 +330,67 @@ void AbstractSocialPostCacheDatabase::setAccountIdFilter(const QVariantList &acc
     }
 }
 
+int AbstractSocialPostCacheDatabase::pageSize() const
+{
+    return d_func()->window.pageSize;
+}
+
+// When the page size is set, refresh() only reads the newest pageSize
+// posts, and fetchMore() appends the next pageSize posts to posts().
+void AbstractSocialPostCacheDatabase::setPageSize(int pageSize)
+{
+    Q_D(AbstractSocialPostCacheDatabase);
+
+    pageSize = qMax(0, pageSize);
+    if (pageSize != d->window.pageSize) {
+        QMutexLocker locker(&d->mutex);
+        d->window.pageSize = pageSize;
+        locker.unlock();
+
+        emit pageSizeChanged();
+    }
+}
+
 QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::posts() const
 {
     return d_func()->posts;
 }
 
+bool AbstractSocialPostCacheDatabase::canFetchMore() const
+{
+    return d_func()->canFetchMore;
+}
+
+// Every write that touches posts is recorded under a new generation.
+// This returns the generation that posts() was read at, which can be
+// passed to queryChanges() later on.
+int AbstractSocialPostCacheDatabase::generation() const
+{
+    return d_func()->generation;
+}
+
+QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::changedPosts() const
+{
+    return d_func()->changes.posts;
+}
+
+QStringList AbstractSocialPostCacheDatabase::removedPosts() const
+{
+    return d_func()->changes.removedPosts;
+}
+
+int AbstractSocialPostCacheDatabase::changesGeneration() const
+{
+    return d_func()->changes.generation;
+}
+
+// False if the change log no longer reaches back to the generation
+// passed to queryChanges(). The consumer must then refresh() instead.
+bool AbstractSocialPostCacheDatabase::changesComplete() const
+{
+    return d_func()->changes.complete;
+}
+
 void AbstractSocialPostCacheDatabase::addPost(const QString &identifier, const QString &name,
                                               const QString &body, const QDateTime &timestamp,
                                               const QString &icon,
@@ -332,127 +457,388 @@ void AbstractSocialPostCacheDatabase::commit()
 
 void AbstractSocialPostCacheDatabase::refresh()
 {
+    Q_D(AbstractSocialPostCacheDatabase);
+
+    {
+        QMutexLocker locker(&d->mutex);
+        d->window.fetchMore = false;
+        d->window.timestamp = 0;
+        d->window.identifier.clear();
+        d->postsRequested = true;
+    }
+
     executeRead();
 }
 
+// Reads the posts inserted, updated or removed after sinceGeneration.
+// changesQueried() is emitted once changedPosts() and removedPosts()
+// hold the result.
+void AbstractSocialPostCacheDatabase::queryChanges(int sinceGeneration)
+{
+    Q_D(AbstractSocialPostCacheDatabase);
+
+    {
+        QMutexLocker locker(&d->mutex);
+        d->changesRequested = true;
+        d->changesSinceGeneration = sinceGeneration;
+    }
+
+    executeRead();
+}
+
+void AbstractSocialPostCacheDatabase::fetchMore()
+{
+    Q_D(AbstractSocialPostCacheDatabase);
+
+    // The keyset is taken from the last loaded post, so wait for
+    // the running read before requesting the next page.
+    if (!d->canFetchMore || d->posts.isEmpty() || readStatus() == Executing) {
+        return;
+    }
+
+    const SocialPost::ConstPtr lastPost = d->posts.last();
+    {
+        QMutexLocker locker(&d->mutex);
+        d->window.fetchMore = true;
+        d->window.timestamp = lastPost->timestamp().toTime_t();
+        d->window.identifier = lastPost->identifier();
+        d->postsRequested = true;
+    }
+
+    executeRead();
+}
+
+static void bindWindow(QSqlQuery &query, const AbstractSocialPostCacheDatabasePrivate::Window &window)
+{
+    if (window.fetchMore) {
+        query.bindValue(QStringLiteral(":beforeTimestamp"), window.timestamp);
+        query.bindValue(QStringLiteral(":sameTimestamp"), window.timestamp);
+        query.bindValue(QStringLiteral(":beforeIdentifier"), window.identifier);
+    }
+    if (window.pageSize > 0) {
+        // One extra row tells whether there is another page.
+        query.bindValue(QStringLiteral(":limit"), window.pageSize + 1);
+    }
+    if (window.changes) {
+        query.bindValue(QStringLiteral(":sinceGeneration"), window.sinceGeneration);
+    }
+}
+
 bool AbstractSocialPostCacheDatabase::read()
 {
     Q_D(AbstractSocialPostCacheDatabase);
-    // This might be slow
-
-    QString accountQueryString = QLatin1String(
-                "SELECT account, postId "
-                "FROM link_post_account");
-    if (!d->accountIdFilter.isEmpty()) {
-        QStringList accountIds;
-        for (int i=0; i<d->accountIdFilter.count(); i++) {
-            if (d->accountIdFilter[i].type() == QVariant::Int) {
-                accountIds << d->accountIdFilter[i].toString();
-            }
-        }
-        if (accountIds.count()) {
-            accountQueryString += " WHERE account IN (" + accountIds.join(',') + ')';
-        }
+
+    QMutexLocker locker(&d->mutex);
+    const bool readPosts = d->postsRequested;
+    const bool readChanges = d->changesRequested;
+    const AbstractSocialPostCacheDatabasePrivate::Window window = d->window;
+    AbstractSocialPostCacheDatabasePrivate::Window changesWindow;
+    changesWindow.pageSize = 0;
+    changesWindow.fetchMore = false;
+    changesWindow.timestamp = 0;
+    changesWindow.changes = true;
+    changesWindow.sinceGeneration = d->changesSinceGeneration;
+    d->postsRequested = false;
+    d->changesRequested = false;
+    locker.unlock();
+
+    // Each request is delivered on its own, so a failed one doesn't
+    // discard the other.
+    AbstractSocialPostCacheDatabasePrivate::ReadResult posts;
+    AbstractSocialPostCacheDatabasePrivate::ReadResult changes;
+    const bool postsRead = readPosts && d->readWindow(window, &posts);
+    const bool changesRead = readChanges && d->readWindow(changesWindow, &changes);
+
+    locker.relock();
+    if (postsRead) {
+        d->asyncPosts = posts;
+        d->asyncFetchMore = window.fetchMore;
+        d->asyncPostsRead = true;
+    }
+    if (changesRead) {
+        d->asyncChanges = changes;
+        d->asyncChangesRead = true;
     }
 
-    QSqlQuery accountQuery = prepare(accountQueryString);
-    if (!accountQuery.exec()) {
-        qWarning() << Q_FUNC_INFO << "Error reading from link_post_account table:" << accountQuery.lastError();
+    return postsRead == readPosts && changesRead == readChanges;
+}
+
+bool AbstractSocialPostCacheDatabasePrivate::readWindow(const Window &window, ReadResult *result)
+{
+    Q_Q(AbstractSocialPostCacheDatabase);
+
+    // The generation is read first, so that the posts read below are
+    // at least as recent as it. Changes queried from this generation
+    // may then be reported twice, but never missed.
+    int generation = 0;
+    bool changesComplete = true;
+    QSqlQuery generationQuery = q->prepare(QStringLiteral(
+                "SELECT MIN(generation), MAX(generation) "
+                "FROM post_changes"));
+    if (!generationQuery.exec() || !generationQuery.next()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from post_changes table:" << generationQuery.lastError();
         return false;
     }
+    if (!generationQuery.isNull(1)) {
+        const int oldestGeneration = generationQuery.value(0).toInt();
+        generation = generationQuery.value(1).toInt();
+        changesComplete = window.sinceGeneration >= oldestGeneration - 1
+                || window.sinceGeneration >= generation;
+    }
+    generationQuery.finish();
+
+    QStringList changedPostIds;
+    if (window.changes) {
+        if (!changesComplete) {
+            result->canFetchMore = false;
+            result->changesComplete = false;
+            result->generation = generation;
+            return true;
+        }
 
-    QStringList filteredPostIds;
-    QHash<QString,QList<int> > accounts;
-    if (accountQuery.exec()) {
-        while (accountQuery.next()) {
-            int accountId = accountQuery.value(0).toInt();
-            QString postId = accountQuery.value(1).toString();
-            accounts[postId].append(accountId);
-            filteredPostIds.append(postId);
+        QSqlQuery changesQuery = q->prepare(QStringLiteral(
+                    "SELECT DISTINCT postId "
+                    "FROM post_changes "
+                    "WHERE generation > :sinceGeneration"));
+        bindWindow(changesQuery, window);
+        if (!changesQuery.exec()) {
+            qWarning() << Q_FUNC_INFO << "Error reading from post_changes table:" << changesQuery.lastError();
+            return false;
+        }
+        while (changesQuery.next()) {
+            changedPostIds.append(changesQuery.value(0).toString());
         }
+        changesQuery.finish();
     }
 
-    QString postQueryString = QLatin1String(
-                "SELECT identifier, name, body, timestamp "
-                "FROM posts");
-    if (!d->accountIdFilter.isEmpty()) {
-        postQueryString += " WHERE identifier IN (\"" + filteredPostIds.join("\",\"") + "\")";
+    // The posts, their images, their extra data and their account links
+    // are each read with a single statement and the SocialPost objects
+    // are assembled in memory, instead of querying images and extra data
+    // once per post. When paging, only the rows of the requested window
+    // of posts are read.
+
+    // The account filter is stored in a temporary table, so that the
+    // text of every statement stays constant and is prepared only once.
+    const bool filterAccounts = !accountIdFilter.isEmpty();
+    QVariantList filterAccountIds;
+    for (int i=0; i<accountIdFilter.count(); i++) {
+        if (accountIdFilter[i].type() == QVariant::Int) {
+            filterAccountIds.append(accountIdFilter[i]);
+        }
+    }
+
+    if (filterAccounts) {
+        bool success = true;
+
+        QSqlQuery query = q->prepare(QStringLiteral(
+                    "CREATE TEMP TABLE IF NOT EXISTS post_filter_accounts ("
+                    " account INTEGER PRIMARY KEY)"));
+        executeSocialCacheQuery(query);
+
+        query = q->prepare(QStringLiteral("DELETE FROM post_filter_accounts"));
+        executeSocialCacheQuery(query);
+
+        if (!filterAccountIds.isEmpty()) {
+            query = q->prepare(QStringLiteral(
+                        "INSERT OR IGNORE INTO post_filter_accounts (account) "
+                        "VALUES (:account)"));
+            query.bindValue(QStringLiteral(":account"), filterAccountIds);
+            executeBatchSocialCacheQuery(query);
+        }
+
+        if (!success) {
+            return false;
+        }
     }
-    postQueryString += " ORDER BY timestamp DESC";
 
-    QSqlQuery postQuery = prepare(postQueryString);
-    QSqlQuery imageQuery = prepare(QLatin1String(
-                "SELECT position, url, type "
-                "FROM images "
-                "WHERE postId = :postId "
-                "ORDER BY position"));
-    QSqlQuery extraQuery = prepare(QLatin1String(
-                "SELECT key, value "
-                "FROM extra "
-                "WHERE postId = :postId"));
+    QStringList conditions;
+    if (filterAccounts) {
+        conditions.append(filterAccountIds.isEmpty()
+                ? QLatin1String(
+                      "identifier IN (SELECT postId FROM link_post_account)")
+                : QLatin1String(
+                      "identifier IN (SELECT postId FROM link_post_account "
+                      "WHERE account IN (SELECT account FROM post_filter_accounts))"));
+    }
+    if (window.changes) {
+        conditions.append(QLatin1String(
+                    "identifier IN (SELECT postId FROM post_changes "
+                    "WHERE generation > :sinceGeneration)"));
+    }
+    if (window.fetchMore) {
+        conditions.append(QLatin1String(
+                    "(timestamp < :beforeTimestamp "
+                    "OR (timestamp = :sameTimestamp AND identifier < :beforeIdentifier))"));
+    }
 
+    QString postSelection = QLatin1String(" FROM posts");
+    if (!conditions.isEmpty()) {
+        postSelection += " WHERE " + conditions.join(QLatin1String(" AND "));
+    }
+    postSelection += QLatin1String(" ORDER BY timestamp DESC, identifier DESC");
+    if (window.pageSize > 0) {
+        postSelection += QLatin1String(" LIMIT :limit");
+    }
 
+    QSqlQuery postQuery = q->prepare(QLatin1String("SELECT identifier, name, body, timestamp")
+                                  + postSelection);
+    bindWindow(postQuery, window);
     if (!postQuery.exec()) {
         qWarning() << Q_FUNC_INFO << "Error reading from posts table:" << postQuery.lastError();
         return false;
     }
 
     QList<SocialPost::ConstPtr> posts;
+    QHash<QString, SocialPost::Ptr> postsById;
+    bool canFetchMore = false;
     while (postQuery.next()) {
-        QString identifier = postQuery.value(0).toString();
+        if (window.pageSize > 0 && posts.count() == window.pageSize) {
+            canFetchMore = true;
+            break;
+        }
 
+        QString identifier = postQuery.value(0).toString();
         QString name = postQuery.value(1).toString();
         QString body = postQuery.value(2).toString();
         int timestamp = postQuery.value(3).toInt();
         SocialPost::Ptr post = SocialPost::create(identifier, name, body,
                                                   QDateTime::fromTime_t(timestamp));
 
-        imageQuery.bindValue(":postId", identifier);
+        posts.append(post);
+        postsById.insert(identifier, post);
+    }
+    postQuery.finish();
+
+    // Without a filter or a window every row belongs to a loaded post,
+    // and a plain table scan is cheaper than the subselect.
+    const QString windowFilter = conditions.isEmpty() && window.pageSize <= 0
+            ? QString()
+            : QLatin1String("postId IN (SELECT identifier") + postSelection + ')';
+    const QString imageAndExtraFilter = windowFilter.isEmpty()
+            ? QString()
+            : QLatin1String(" WHERE ") + windowFilter;
+
+    if (!posts.isEmpty()) {
+        QStringList accountConditions;
+        if (!filterAccountIds.isEmpty()) {
+            accountConditions.append(QLatin1String(
+                        "account IN (SELECT account FROM post_filter_accounts)"));
+        }
+        if (!windowFilter.isEmpty()) {
+            accountConditions.append(windowFilter);
+        }
+
+        QString accountSelection = QLatin1String(
+                    "SELECT account, postId "
+                    "FROM link_post_account");
+        if (!accountConditions.isEmpty()) {
+            accountSelection += " WHERE " + accountConditions.join(QLatin1String(" AND "));
+        }
+
+        QSqlQuery accountQuery = q->prepare(accountSelection);
+        bindWindow(accountQuery, window);
+        if (!accountQuery.exec()) {
+            qWarning() << Q_FUNC_INFO << "Error reading from link_post_account table:" << accountQuery.lastError();
+            return false;
+        }
+
+        QHash<QString, QList<int> > accounts;
+        while (accountQuery.next()) {
+            const QString postId = accountQuery.value(1).toString();
+            if (postsById.contains(postId)) {
+                accounts[postId].append(accountQuery.value(0).toInt());
+            }
+        }
+        accountQuery.finish();
+
+        for (QHash<QString, QList<int> >::const_iterator it = accounts.constBegin();
+                it != accounts.constEnd(); ++it) {
+            postsById.value(it.key())->setAccounts(it.value());
+        }
 
-        QMap<int, SocialPostImage::ConstPtr> images;
+        QSqlQuery imageQuery = q->prepare(QLatin1String(
+                    "SELECT postId, position, url, type "
+                    "FROM images")
+                    + imageAndExtraFilter
+                    + QLatin1String(" ORDER BY postId, position"));
+        bindWindow(imageQuery, window);
         if (imageQuery.exec()) {
+            QString currentPostId;
+            SocialPost::Ptr currentPost;
+            QMap<int, SocialPostImage::ConstPtr> images;
             while (imageQuery.next()) {
+                const QString postId = imageQuery.value(0).toString();
+                if (postId != currentPostId) {
+                    if (currentPost) {
+                        currentPost->setImages(images);
+                    }
+                    currentPostId = postId;
+                    currentPost = postsById.value(postId);
+                    images.clear();
+                }
+                if (!currentPost) {
+                    continue;
+                }
+
                 SocialPostImage::ImageType type = SocialPostImage::Invalid;
-                QString typeString = imageQuery.value(2).toString();
+                QString typeString = imageQuery.value(3).toString();
                 if (typeString == QLatin1String(PHOTO)) {
                     type = SocialPostImage::Photo;
                 } else if (typeString == QLatin1String(VIDEO)) {
                     type = SocialPostImage::Video;
                 }
 
-                int position = imageQuery.value(0).toInt();
-                SocialPostImage::Ptr image  = SocialPostImage::create(imageQuery.value(1).toString(),
-                                                                      type);
-                images.insert(position, image);
+                int position = imageQuery.value(1).toInt();
+                images.insert(position, SocialPostImage::create(imageQuery.value(2).toString(), type));
+            }
+            if (currentPost) {
+                currentPost->setImages(images);
             }
-            post->setImages(images);
+            imageQuery.finish();
         } else {
             qWarning() << Q_FUNC_INFO << "Error reading from images table:"
                        << imageQuery.lastError();
         }
 
-        extraQuery.bindValue(":postId", identifier);
-
-        QVariantMap extra;
+        QSqlQuery extraQuery = q->prepare(QLatin1String(
+                    "SELECT postId, key, value "
+                    "FROM extra")
+                    + imageAndExtraFilter);
+        bindWindow(extraQuery, window);
         if (extraQuery.exec()) {
+            QHash<QString, QVariantMap> extras;
             while (extraQuery.next()) {
-                QString key = extraQuery.value(0).toString();
-                QVariant value = extraQuery.value(1);
-                extra.insert(key, value);
+                const QString postId = extraQuery.value(0).toString();
+                if (postsById.contains(postId)) {
+                    extras[postId].insert(extraQuery.value(1).toString(), extraQuery.value(2));
+                }
+            }
+            extraQuery.finish();
+
+            for (QHash<QString, QVariantMap>::const_iterator it = extras.constBegin();
+                    it != extras.constEnd(); ++it) {
+                postsById.value(it.key())->setExtra(it.value());
             }
         } else {
             qWarning() << Q_FUNC_INFO << "Error reading from extra table:"
                        << extraQuery.lastError();
         }
+    }
 
-        post->setExtra(extra);
-        post->setAccounts(accounts[identifier]);
-
-        posts.append(post);
+    // Changed posts that are not found anymore, or that do not match
+    // the account filter anymore, are reported as removed.
+    QStringList removedPostIds;
+    Q_FOREACH (const QString &postId, changedPostIds) {
+        if (!postsById.contains(postId)) {
+            removedPostIds.append(postId);
+        }
     }
 
-    QMutexLocker locker(&d->mutex);
-    d->asyncPosts = posts;
+    result->posts = posts;
+    result->removedPosts = removedPostIds;
+    result->canFetchMore = canFetchMore;
+    result->changesComplete = changesComplete;
+    result->generation = generation;
 
     return true;
 }
@@ -481,14 +867,37 @@ bool AbstractSocialPostCacheDatabase::write()
 
     QSqlQuery query;
 
+    // Every post touched by this write is logged in post_changes
+    // under a new generation, so that readers can query the delta.
+    query = prepare(QStringLiteral(
+                "SELECT MAX(generation) "
+                "FROM post_changes"));
+    if (!query.exec() || !query.next()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from post_changes table:" << query.lastError();
+        return false;
+    }
+    const int generation = query.value(0).toInt() + 1;
+    query.finish();
+
     // perform removals first.
     if (!removePosts.isEmpty()) {
         QVariantList postIds;
+        QVariantList generations;
 
         Q_FOREACH (const QString postId, removePosts) {
             postIds.append(postId);
+            generations.append(generation);
         }
 
+        query = prepare(QStringLiteral(
+                    "INSERT OR IGNORE INTO post_changes ("
+                    " generation, postId) "
+                    "VALUES ("
+                    " :generation, :postId)"));
+        query.bindValue(QStringLiteral(":generation"), generations);
+        query.bindValue(QStringLiteral(":postId"), postIds);
+        executeBatchSocialCacheQuery(query);
+
         query = prepare(QStringLiteral(
                     "DELETE FROM posts "
                     "WHERE identifier = :postId"));
@@ -519,6 +928,23 @@ bool AbstractSocialPostCacheDatabase::write()
             }
         }
 
+        // A post that loses an account but keeps another one is changed
+        // too, as its accounts() no longer match, so log every post that
+        // loses a link rather than only the ones removed below.
+        QVariantList generations;
+        for (int i = 0; i < accountIds.count(); ++i) {
+            generations.append(generation);
+        }
+
+        query = prepare(QStringLiteral(
+                    "INSERT OR IGNORE INTO post_changes ("
+                    " generation, postId) "
+                    "SELECT :generation, postId FROM link_post_account "
+                    "WHERE account = :accountId"));
+        query.bindValue(QStringLiteral(":generation"), generations);
+        query.bindValue(QStringLiteral(":accountId"), accountIds);
+        executeBatchSocialCacheQuery(query);
+
         query = prepare(QStringLiteral(
                     "DELETE FROM link_post_account "
                     "WHERE account = :accountId"));
@@ -537,6 +963,15 @@ bool AbstractSocialPostCacheDatabase::write()
                     "SELECT postId FROM link_post_account)"));
         executeSocialCacheQuery(query);
 
+        query = prepare(QStringLiteral(
+                    "INSERT OR IGNORE INTO post_changes ("
+                    " generation, postId) "
+                    "SELECT :generation, identifier FROM posts "
+                    "WHERE identifier NOT IN ("
+                    "SELECT postId FROM link_post_account)"));
+        query.bindValue(QStringLiteral(":generation"), generation);
+        executeSocialCacheQuery(query);
+
         query = prepare(QStringLiteral(
                     "DELETE FROM posts "
                     "WHERE identifier NOT IN ("
@@ -549,6 +984,7 @@ bool AbstractSocialPostCacheDatabase::write()
         QVariantList names;
         QVariantList bodies;
         QVariantList timestamps;
+        QVariantList generations;
     } posts;
 
     struct {
@@ -580,6 +1016,7 @@ bool AbstractSocialPostCacheDatabase::write()
         posts.names.append(post->name());
         posts.bodies.append(post->body());
         posts.timestamps.append(post->timestamp().toTime_t());
+        posts.generations.append(generation);
 
         const QMap<int, SocialPostImage::ConstPtr> postImages = post->allImages();
         typedef QMap<int, SocialPostImage::ConstPtr>::const_iterator iterator;
@@ -645,6 +1082,15 @@ bool AbstractSocialPostCacheDatabase::write()
         query.bindValue(QStringLiteral(":body"), posts.bodies);
         query.bindValue(QStringLiteral(":timestamp"), posts.timestamps);
         executeBatchSocialCacheQuery(query);
+
+        query = prepare(QStringLiteral(
+                    "INSERT OR IGNORE INTO post_changes ("
+                    " generation, postId) "
+                    "VALUES ("
+                    " :generation, :postId)"));
+        query.bindValue(QStringLiteral(":generation"), posts.generations);
+        query.bindValue(QStringLiteral(":postId"), posts.postIds);
+        executeBatchSocialCacheQuery(query);
     }
 
     if (!images.postIds.isEmpty()) {
@@ -683,9 +1129,69 @@ bool AbstractSocialPostCacheDatabase::write()
         executeBatchSocialCacheQuery(query);
     }
 
+    query = prepare(QStringLiteral(
+                "DELETE FROM post_changes "
+                "WHERE generation <= :generation"));
+    query.bindValue(QStringLiteral(":generation"), generation - MAX_CHANGE_GENERATIONS);
+    executeSocialCacheQuery(query);
+
     return success;
 }
 
+// Version 2 adds the indexes used when reading and deleting posts.
+// The postId column of link_post_account is already covered by its
+// primary key, so only its account column needs an index.
+static bool createPostIndexes(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_postId ON images(postId, position)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create images index" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS extra_postId ON extra(postId)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create extra index" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS link_post_account_account ON link_post_account(account)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create link_post_account index"
+                   << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS posts_timestamp ON posts(timestamp)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create posts index" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+// Version 3 adds the change log. post_changes holds one row per post
+// inserted, updated or removed by each write generation.
+static bool createPostChangesTable(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    query.prepare("CREATE TABLE IF NOT EXISTS post_changes ("\
+                  "generation INTEGER, "\
+                  "postId TEXT, "\
+                  "CONSTRAINT id PRIMARY KEY (generation, postId))");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create post_changes table"
+                   << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
 bool AbstractSocialPostCacheDatabase::createTables(QSqlDatabase database) const
 {
     QSqlQuery query (database);
@@ -739,7 +1245,19 @@ bool AbstractSocialPostCacheDatabase::createTables(QSqlDatabase database) const
         return false;
     }
 
-    return true;
+    return createPostIndexes(database) && createPostChangesTable(database);
+}
+
+bool AbstractSocialPostCacheDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    switch (fromVersion) {
+    case 1:
+        return createPostIndexes(database);
+    case 2:
+        return createPostChangesTable(database);
+    default:
+        return false;
+    }
 }
 
 bool AbstractSocialPostCacheDatabase::dropTables(QSqlDatabase database) const
@@ -773,6 +1291,13 @@ bool AbstractSocialPostCacheDatabase::dropTables(QSqlDatabase database) const
         return false;
     }
 
+    query.prepare("DROP TABLE IF EXISTS post_changes");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to delete post_changes table"
+                   << query.lastError().text();
+        return false;
+    }
+
     return true;
 }
 
@@ -781,10 +1306,37 @@ void AbstractSocialPostCacheDatabase::readFinished()
     Q_D(AbstractSocialPostCacheDatabase);
     QMutexLocker locker(&d->mutex);
 
-    d->posts = d->asyncPosts;
-    d->asyncPosts.clear();
+    const bool postsRead = d->asyncPostsRead;
+    const bool changesRead = d->asyncChangesRead;
+
+    if (postsRead) {
+        if (d->asyncFetchMore) {
+            d->posts += d->asyncPosts.posts;
+        } else {
+            d->posts = d->asyncPosts.posts;
+            d->generation = d->asyncPosts.generation;
+        }
+        d->canFetchMore = d->asyncPosts.canFetchMore;
+        d->asyncPosts.posts.clear();
+        d->asyncPostsRead = false;
+    }
+
+    if (changesRead) {
+        d->changes.posts = d->asyncChanges.posts;
+        d->changes.removedPosts = d->asyncChanges.removedPosts;
+        d->changes.generation = d->asyncChanges.generation;
+        d->changes.complete = d->asyncChanges.changesComplete;
+        d->asyncChanges.posts.clear();
+        d->asyncChanges.removedPosts.clear();
+        d->asyncChangesRead = false;
+    }
 
     locker.unlock();
 
-    emit postsChanged();
+    if (postsRead) {
+        emit postsChanged();
+    }
+    if (changesRead) {
+        emit changesQueried();
+    }
 }
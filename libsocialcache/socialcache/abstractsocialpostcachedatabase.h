@@ -22,6 +22,7 @@
 #include "abstractsocialcachedatabase.h"
 #include <QtCore/QSharedPointer>
 #include <QtCore/QDateTime>
+#include <QtCore/QStringList>
 #include <QtCore/QVariantMap>
 
 class SocialPostImagePrivate;
@@ -99,6 +100,7 @@ class AbstractSocialPostCacheDatabase: public AbstractSocialCacheDatabase
 {
     Q_OBJECT
     Q_PROPERTY(QVariantList accountIdFilter READ accountIdFilter WRITE setAccountIdFilter NOTIFY accountIdFilterChanged)
+    Q_PROPERTY(int pageSize READ pageSize WRITE setPageSize NOTIFY pageSizeChanged)
 public:
     explicit AbstractSocialPostCacheDatabase(
             const QString &serviceName, const QString &databaseFile);
@@ -107,7 +109,17 @@ public:
     QVariantList accountIdFilter() const;
     void setAccountIdFilter(const QVariantList &accountIds);
 
+    int pageSize() const;
+    void setPageSize(int pageSize);
+
     QList<SocialPost::ConstPtr> posts() const;
+    bool canFetchMore() const;
+    int generation() const;
+
+    QList<SocialPost::ConstPtr> changedPosts() const;
+    QStringList removedPosts() const;
+    int changesGeneration() const;
+    bool changesComplete() const;
 
     void addPost(const QString &identifier, const QString &name,
                  const QString &body, const QDateTime &timestamp,
@@ -121,16 +133,21 @@ public:
 
     void commit();
     void refresh();
+    void fetchMore();
+    void queryChanges(int sinceGeneration);
 
 Q_SIGNALS:
     void postsChanged();
     void accountIdFilterChanged();
+    void pageSizeChanged();
+    void changesQueried();
 
 protected:
     bool read();
     bool write();
     bool createTables(QSqlDatabase database) const;
     bool dropTables(QSqlDatabase database) const;
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
     void readFinished();
 
@@ -33,144 +33,174 @@
 #include "semaphore_p.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#include <sys/sem.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
 
+#include <QElapsedTimer>
+#include <QFile>
 #include <QtDebug>
 
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 namespace {
 
-// Defined as required for ::semun
-union semun {
-    int              val;
-    struct semid_ds *buf;
-    unsigned short  *array;
-    struct seminfo  *__buf;
-};
+// A contended lock() blocks in flock() until a timer signals the waiting
+// thread. The signal has a handler that does nothing, so it only makes
+// flock() fail with EINTR.
+const int LOCK_TIMEOUT_SIGNAL = SIGRTMIN + 4;
 
-}
+// Once the timeout has passed the timer keeps firing at this interval, in
+// case the first signal arrived before the thread entered flock().
+const int LOCK_TIMEOUT_REPEAT = 10;
 
-Semaphore::Semaphore(const char *id, int initial)
-    : m_identifier(id)
-    , m_initialValue(-1)
-    , m_id(-1)
+void lockTimeoutHandler(int)
 {
-    key_t key = ::ftok(m_identifier, 0);
-
-    m_id = ::semget(key, 1, 0);
-    if (m_id == -1) {
-        if (errno != ENOENT) {
-            error("Unable to get semaphore", errno);
-        } else {
-            // The semaphore does not currently exist
-            m_id = ::semget(key, 1, IPC_CREAT | IPC_EXCL | S_IRWXU);
-            if (m_id == -1) {
-                if (errno == EEXIST) {
-                    // Someone else won the race to create the semaphore - retry get 
-                    m_id = ::semget(key, 1, 0);
-                }
-
-                if (m_id == -1) {
-                    error("Unable to create semaphore", errno);
-                }
-            } else {
-                // Set the initial value
-                union semun arg = { 0 };
-                arg.val = initial;
-
-                int status = ::semctl(m_id, 0, SETVAL, arg);
-                if (status == -1) {
-                    m_id = -1;
-                    error("Unable to initialize semaphore", errno);
-                } else {
-                    m_initialValue = initial;
-                }
-            }
-        }
-    }
 }
 
-Semaphore::~Semaphore()
+bool installLockTimeoutHandler()
 {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = lockTimeoutHandler;
+    sigemptyset(&action.sa_mask);
+    // No SA_RESTART, so that the signal interrupts flock()
+    return ::sigaction(LOCK_TIMEOUT_SIGNAL, &action, 0) == 0;
 }
 
-bool Semaphore::decrement()
+void setTimespec(struct timespec *spec, int msecs)
 {
-    if (m_id == -1)
-        return false;
-
-    struct sembuf op;
-    op.sem_num = 0;
-    op.sem_op = -1;
-    op.sem_flg = SEM_UNDO;
-
-    if (::semop(m_id, &op, 1) == 0)
-        return true;
-
-    error("Unable to decrement semaphore", errno);
-    return false;
+    spec->tv_sec = msecs / 1000;
+    spec->tv_nsec = (msecs % 1000) * 1000000L;
 }
 
-bool Semaphore::increment()
-{
-    if (m_id == -1)
-        return false;
-
-    struct sembuf op;
-    op.sem_num = 0;
-    op.sem_op = 1;
-    op.sem_flg = SEM_UNDO;
-
-    if (::semop(m_id, &op, 1) == 0)
-        return true;
-
-    error("Unable to increment semaphore", errno);
-    return false;
 }
 
-int Semaphore::value() const
+ProcessMutex::ProcessMutex(const QString &path)
+    : m_path(QFile::encodeName(path))
+    , m_fd(-1)
 {
-    if (m_id == -1)
-        return -1;
-
-    return ::semctl(m_id, 0, GETVAL, 0);
 }
 
-void Semaphore::error(const char *msg, int error)
+ProcessMutex::~ProcessMutex()
 {
-    qWarning() << QString("%1 %2: %3 (%4)").arg(msg).arg(m_identifier).arg(::strerror(error)).arg(error);
+    if (m_fd != -1) {
+        ::close(m_fd);
+    }
 }
 
-ProcessMutex::ProcessMutex(const QString &path)
-    : m_semaphore(path.toLatin1(), 1)
+bool ProcessMutex::lock(int timeout)
 {
-}
+    if (m_fd == -1) {
+        m_fd = ::open(m_path.constData(), O_RDWR | O_CREAT | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (m_fd == -1) {
+            error("Unable to open lock file", errno);
+            return false;
+        }
+    }
 
-bool ProcessMutex::lock()
-{
-    if (!m_semaphore.decrement()) {
+    // Uncontended locks take a single call
+    if (::flock(m_fd, LOCK_EX | LOCK_NB) == 0) {
+        return true;
+    } else if (errno != EWOULDBLOCK && errno != EINTR) {
+        error("Unable to lock", errno);
         return false;
+    } else if (timeout == 0) {
+        return timedOut(timeout);
     }
 
-    if (m_mutex.tryLock(40)) {
-        return true;
+    timer_t timer;
+    bool timerCreated = false;
+    sigset_t signals;
+    sigset_t previousSignals;
+    sigemptyset(&signals);
+    sigaddset(&signals, LOCK_TIMEOUT_SIGNAL);
+
+    if (timeout > 0) {
+        static const bool handlerInstalled = installLockTimeoutHandler();
+        if (!handlerInstalled) {
+            error("Unable to install lock timeout handler", errno);
+            return false;
+        }
+
+        struct sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = LOCK_TIMEOUT_SIGNAL;
+        event.sigev_notify_thread_id = ::syscall(SYS_gettid);
+        if (::timer_create(CLOCK_MONOTONIC, &event, &timer) == -1) {
+            error("Unable to create lock timer", errno);
+            return false;
+        }
+        timerCreated = true;
+
+        struct itimerspec expiry;
+        setTimespec(&expiry.it_value, timeout);
+        setTimespec(&expiry.it_interval, LOCK_TIMEOUT_REPEAT);
+        ::pthread_sigmask(SIG_UNBLOCK, &signals, &previousSignals);
+        ::timer_settime(timer, 0, &expiry, 0);
     }
 
-    return false;
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    bool locked = false;
+    Q_FOREVER {
+        if (::flock(m_fd, LOCK_EX) == 0) {
+            locked = true;
+            break;
+        } else if (errno != EINTR) {
+            error("Unable to lock", errno);
+            break;
+        } else if (timeout > 0 && elapsed.elapsed() >= timeout) {
+            timedOut(timeout);
+            break;
+        }
+    }
+
+    if (timerCreated) {
+        ::timer_delete(timer);
+        ::pthread_sigmask(SIG_SETMASK, &previousSignals, 0);
+    }
+
+    return locked;
 }
 
 bool ProcessMutex::unlock()
 {
-    m_mutex.unlock();
-    bool couldRelease = m_semaphore.increment();
-    if (!couldRelease) {
+    if (m_fd == -1) {
         return false;
     }
 
+    while (::flock(m_fd, LOCK_UN) == -1) {
+        if (errno != EINTR) {
+            error("Unable to unlock", errno);
+            return false;
+        }
+    }
+
     return true;
 }
 
+bool ProcessMutex::timedOut(int timeout)
+{
+    qWarning() << QString("Timed out after %1 ms waiting for lock %2")
+                  .arg(timeout).arg(QString::fromLocal8Bit(m_path));
+    return false;
+}
+
+void ProcessMutex::error(const char *msg, int error)
+{
+    qWarning() << QString("%1 %2: %3 (%4)").arg(msg).arg(QString::fromLocal8Bit(m_path)).arg(::strerror(error)).arg(error);
+}
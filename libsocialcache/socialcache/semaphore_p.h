@@ -33,37 +33,29 @@
 #ifndef SEMAPHORE_P_H
 #define SEMAPHORE_P_H
 
+#include <QByteArray>
 #include <QString>
-#include <QMutex>
 
-class Semaphore
+// Exclusive write lock shared by every connection to a database, in this and
+// other processes. It is an flock() on a lock file next to the database; each
+// instance owns its own descriptor, so threads of one process exclude each
+// other as well. The lock is dropped by the kernel if the holder dies.
+class ProcessMutex
 {
 public:
-    Semaphore(const char *identifier, int initial);
-    ~Semaphore();
-
-    bool decrement();
-    bool increment();
+    explicit ProcessMutex(const QString &path);
+    ~ProcessMutex();
 
-    int value() const;
+    // Blocks for at most timeout milliseconds (negative waits forever)
+    bool lock(int timeout);
+    bool unlock();
 
 private:
+    bool timedOut(int timeout);
     void error(const char *msg, int error);
 
-    const char *m_identifier;
-    int m_initialValue;
-    int m_id;
-};
-
-class ProcessMutex
-{
-    Semaphore m_semaphore;
-    QMutex m_mutex;
-
-public:
-    ProcessMutex(const QString &path);
-    bool lock();
-    bool unlock();
+    QByteArray m_path;
+    int m_fd;
 };
 
 
@@ -19,16 +19,20 @@
 
 #include "socialimagesdatabase.h"
 #include "abstractsocialcachedatabase.h"
+#include "abstractimagedownloader.h"
 #include "socialsyncinterface.h"
 
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSet>
 
 #include <QtDebug>
 
 static const char *DB_NAME = "socialimagecache.db";
-static const int VERSION = 4;
+static const int VERSION = 9;
+static const int PURGE_BATCH_SIZE = 500;
 
 struct SocialImagePrivate
 {
@@ -37,13 +41,19 @@ struct SocialImagePrivate
                                 const QString &imageFile,
                                 const QDateTime &createdTime,
                                 const QDateTime &expires,
-                                const QString &imageId);
+                                const QString &imageId,
+                                const QByteArray &etag,
+                                const QByteArray &lastModified,
+                                const QString &contentHash);
     int accountId;
     QString imageUrl;
     QString imageFile;
     QDateTime createdTime;
     QDateTime expires;
     QString imageId;
+    QByteArray etag;
+    QByteArray lastModified;
+    QString contentHash;
 };
 
 SocialImagePrivate::SocialImagePrivate(int accountId,
@@ -51,13 +61,19 @@ SocialImagePrivate::SocialImagePrivate(int accountId,
                                        const QString &imageFile,
                                        const QDateTime &createdTime,
                                        const QDateTime &expires,
-                                       const QString &imageId)
+                                       const QString &imageId,
+                                       const QByteArray &etag,
+                                       const QByteArray &lastModified,
+                                       const QString &contentHash)
     : accountId(accountId)
     , imageUrl(imageUrl)
     , imageFile(imageFile)
     , createdTime(createdTime)
     , expires(expires)
     , imageId(imageId)
+    , etag(etag)
+    , lastModified(lastModified)
+    , contentHash(contentHash)
 {
 }
 
@@ -66,10 +82,15 @@ SocialImage::SocialImage(int accountId,
                          const QString &imageFile,
                          const QDateTime &createdTime,
                          const QDateTime &expires,
-                         const QString &imageId)
+                         const QString &imageId,
+                         const QByteArray &etag,
+                         const QByteArray &lastModified,
+                         const QString &contentHash)
     : d_ptr(new SocialImagePrivate(accountId, imageUrl,
                                    imageFile, createdTime,
-                                   expires, imageId))
+                                   expires, imageId,
+                                   etag, lastModified,
+                                   contentHash))
 {
 }
 
@@ -82,11 +103,16 @@ SocialImage::Ptr SocialImage::create(int accountId,
                                      const QString & imageFile,
                                      const QDateTime &createdTime,
                                      const QDateTime &expires,
-                                     const QString &imageId)
+                                     const QString &imageId,
+                                     const QByteArray &etag,
+                                     const QByteArray &lastModified,
+                                     const QString &contentHash)
 {
     return SocialImage::Ptr(new SocialImage(accountId, imageUrl,
                                             imageFile, createdTime,
-                                            expires, imageId));
+                                            expires, imageId,
+                                            etag, lastModified,
+                                            contentHash));
 }
 
 int SocialImage::accountId() const
@@ -125,6 +151,24 @@ QString SocialImage::imageId() const
     return d->imageId;
 }
 
+QByteArray SocialImage::etag() const
+{
+    Q_D(const SocialImage);
+    return d->etag;
+}
+
+QByteArray SocialImage::lastModified() const
+{
+    Q_D(const SocialImage);
+    return d->lastModified;
+}
+
+QString SocialImage::contentHash() const
+{
+    Q_D(const SocialImage);
+    return d->contentHash;
+}
+
 class SocialImagesDatabasePrivate: public AbstractSocialCacheDatabasePrivate
 {
 public:
@@ -134,7 +178,19 @@ public:
 private:
     Q_DECLARE_PUBLIC(SocialImagesDatabase)
 
-    static void clearCachedImages(QSqlQuery &query);
+    struct ImageRow
+    {
+        qint64 rowId;
+        QString imageFile;
+        QString contentHash;
+        QString imageUrl;
+    };
+
+    bool purgeImages(int accountId, bool expiredOnly, bool *finished);
+    bool evictImages(int accountId, qint64 maximumBytes, bool *finished);
+    bool removeImageRows(const QList<ImageRow> &rows);
+    void releaseContent(const QSet<QString> &contentHashes);
+    void releaseThumbnails(const QSet<QString> &imageUrls);
 
     QList<SocialImage::ConstPtr> queryImages(int accountId,
                                              const QDateTime &olderThan);
@@ -142,8 +198,12 @@ private:
 
     struct {
         QList<int> purgeAccounts;
+        QList<int> purgeExpired;
+        QMap<int, qint64> evictImages;
+        QSet<QString> touchImages;
         QStringList removeImages;
         QMap<QString, SocialImage::ConstPtr> insertImages;
+        QMap<QString, QMap<int, QString> > insertThumbnails;
     } queue;
 
     struct {
@@ -157,6 +217,21 @@ private:
         QList<SocialImage::ConstPtr> images;
     } result;
 
+    struct {
+        bool pending;
+        bool continues;
+        int imageCount;
+        qint64 bytesReclaimed;
+    } purged;
+
+    // Files of the rows deleted by the running write. They are removed
+    // by writeCommitted(), so a rolled back delete never loses a file.
+    struct {
+        QStringList files;
+        QStringList links;
+        int imageCount;
+    } removed;
+
     QSqlQuery m_singleImageQuery;
 };
 
@@ -168,23 +243,230 @@ SocialImagesDatabasePrivate::SocialImagesDatabasePrivate(SocialImagesDatabase *q
             QLatin1String(DB_NAME),
             VERSION)
 {
+    purged.pending = false;
+    purged.continues = false;
+    purged.imageCount = 0;
+    purged.bytesReclaimed = 0;
+    removed.imageCount = 0;
 }
 
 SocialImagesDatabasePrivate::~SocialImagesDatabasePrivate()
 {
 }
 
-void SocialImagesDatabasePrivate::clearCachedImages(QSqlQuery &query)
+// Removes one batch of the images of an account, or of its expired ones,
+// together with their cached files. Runs on the writer thread; finished is
+// set once no matching rows are left.
+bool SocialImagesDatabasePrivate::purgeImages(int accountId, bool expiredOnly, bool *finished)
 {
+    Q_Q(SocialImagesDatabase);
+
+    QString queryString = QLatin1String("SELECT rowid, imageFile, contentHash, imageUrl FROM images "
+                                        "WHERE accountId = :accountId");
+    if (expiredOnly) {
+        queryString.append(QLatin1String(" AND expires < :currentTime"));
+    }
+    queryString.append(QLatin1String(" ORDER BY rowid LIMIT :limit"));
+
+    QSqlQuery query = q->prepare(queryString);
+    query.bindValue(QStringLiteral(":accountId"), accountId);
+    if (expiredOnly) {
+        query.bindValue(QStringLiteral(":currentTime"), QDateTime::currentDateTime().toTime_t());
+    }
+    query.bindValue(QStringLiteral(":limit"), PURGE_BATCH_SIZE);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query images to purge:" << query.lastError().text();
+        return false;
+    }
+
+    QList<ImageRow> rows;
     while (query.next()) {
-        QString image = query.value(0).toString();
-        if (!image.isEmpty()) {
-            QFile imageFile(image);
-            if (imageFile.exists()) {
-                imageFile.remove();
-            }
+        ImageRow row;
+        row.rowId = query.value(0).toLongLong();
+        row.imageFile = query.value(1).toString();
+        row.contentHash = query.value(2).toString();
+        row.imageUrl = query.value(3).toString();
+        rows.append(row);
+    }
+    query.finish();
+
+    *finished = rows.count() < PURGE_BATCH_SIZE;
+
+    return rows.isEmpty() || removeImageRows(rows);
+}
+
+// Removes one batch of the account's least recently used images, towards
+// the rest fitting in maximumBytes. Runs on the writer thread; finished is
+// set once they fit.
+bool SocialImagesDatabasePrivate::evictImages(int accountId, qint64 maximumBytes, bool *finished)
+{
+    Q_Q(SocialImagesDatabase);
+
+    QSqlQuery query = q->prepare(QStringLiteral(
+                "SELECT SUM(fileSize) FROM images WHERE accountId = :accountId"));
+    query.bindValue(QStringLiteral(":accountId"), accountId);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query cache size:" << query.lastError().text();
+        return false;
+    }
+    qint64 excessBytes = (query.next() ? query.value(0).toLongLong() : 0) - maximumBytes;
+    query.finish();
+
+    *finished = true;
+    if (excessBytes <= 0) {
+        return true;
+    }
+
+    query = q->prepare(QStringLiteral(
+                "SELECT rowid, imageFile, contentHash, imageUrl, fileSize FROM images "
+                "WHERE accountId = :accountId "
+                "ORDER BY lastAccess, rowid LIMIT :limit"));
+    query.bindValue(QStringLiteral(":accountId"), accountId);
+    query.bindValue(QStringLiteral(":limit"), PURGE_BATCH_SIZE);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query images to evict:" << query.lastError().text();
+        return false;
+    }
+
+    QList<ImageRow> rows;
+    while (excessBytes > 0 && query.next()) {
+        ImageRow row;
+        row.rowId = query.value(0).toLongLong();
+        row.imageFile = query.value(1).toString();
+        row.contentHash = query.value(2).toString();
+        row.imageUrl = query.value(3).toString();
+        rows.append(row);
+        excessBytes -= query.value(4).toLongLong();
+    }
+    query.finish();
+
+    *finished = excessBytes <= 0 || rows.count() < PURGE_BATCH_SIZE;
+
+    return rows.isEmpty() || removeImageRows(rows);
+}
+
+// Deletes the rows and queues the files they own for removal. A file is
+// only removed once no other row refers to it; files linked to the shared
+// content store and thumbnails go once nothing else refers to them.
+bool SocialImagesDatabasePrivate::removeImageRows(const QList<ImageRow> &rows)
+{
+    Q_Q(SocialImagesDatabase);
+
+    QVariantList rowIds;
+    QSet<QString> imageUrls;
+    Q_FOREACH (const ImageRow &row, rows) {
+        rowIds.append(row.rowId);
+        imageUrls.insert(row.imageUrl);
+    }
+
+    QSqlQuery query = q->prepare(QStringLiteral("DELETE FROM images WHERE rowid = :rowid"));
+    query.bindValue(QStringLiteral(":rowid"), rowIds);
+    if (!query.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete images:" << query.lastError().text();
+        return false;
+    }
+    query.finish();
+
+    QSet<QString> contentHashes;
+    QSet<QString> imageFiles;
+    Q_FOREACH (const ImageRow &row, rows) {
+        if (row.imageFile.isEmpty() || imageFiles.contains(row.imageFile)) {
+            continue;
+        }
+        imageFiles.insert(row.imageFile);
+
+        query = q->prepare(QStringLiteral(
+                    "SELECT 1 FROM images WHERE imageFile = :imageFile LIMIT 1"));
+        query.bindValue(QStringLiteral(":imageFile"), row.imageFile);
+        if (!query.exec()) {
+            qWarning() << Q_FUNC_INFO << "Failed to count file references:" << query.lastError().text();
+            continue;
+        }
+        const bool referenced = query.next();
+        query.finish();
+        if (referenced) {
+            continue;
+        }
+
+        if (!row.contentHash.isEmpty()) {
+            // Only a link; the space is reclaimed with the shared content
+            removed.links.append(row.imageFile);
+            contentHashes.insert(row.contentHash);
+            continue;
+        }
+        removed.files.append(row.imageFile);
+    }
+
+    releaseContent(contentHashes);
+    releaseThumbnails(imageUrls);
+
+    removed.imageCount += rows.count();
+
+    return true;
+}
+
+// Queues the removal of the shared content no image refers to any more.
+void SocialImagesDatabasePrivate::releaseContent(const QSet<QString> &contentHashes)
+{
+    Q_Q(SocialImagesDatabase);
+
+    Q_FOREACH (const QString &contentHash, contentHashes) {
+        QSqlQuery query = q->prepare(QStringLiteral(
+                    "SELECT 1 FROM images WHERE contentHash = :contentHash LIMIT 1"));
+        query.bindValue(QStringLiteral(":contentHash"), contentHash);
+        if (!query.exec()) {
+            qWarning() << Q_FUNC_INFO << "Failed to count content references:" << query.lastError().text();
+            continue;
+        }
+        const bool referenced = query.next();
+        query.finish();
+
+        if (!referenced) {
+            removed.files.append(AbstractImageDownloader::makeContentFile(contentHash));
+        }
+    }
+}
+
+// Deletes the thumbnails of urls no image refers to any more, and queues
+// the removal of their files.
+void SocialImagesDatabasePrivate::releaseThumbnails(const QSet<QString> &imageUrls)
+{
+    Q_Q(SocialImagesDatabase);
+
+    QVariantList releasedUrls;
+    QStringList thumbnailFiles;
+    Q_FOREACH (const QString &imageUrl, imageUrls) {
+        QSqlQuery query = q->prepare(QStringLiteral(
+                    "SELECT thumbnailFile FROM thumbnails WHERE imageUrl = :imageUrl "
+                    "AND NOT EXISTS (SELECT 1 FROM images WHERE imageUrl = :referencedUrl)"));
+        query.bindValue(QStringLiteral(":imageUrl"), imageUrl);
+        query.bindValue(QStringLiteral(":referencedUrl"), imageUrl);
+        if (!query.exec()) {
+            qWarning() << Q_FUNC_INFO << "Failed to query thumbnails:" << query.lastError().text();
+            continue;
+        }
+        if (query.next()) {
+            releasedUrls.append(imageUrl);
+            do {
+                thumbnailFiles.append(query.value(0).toString());
+            } while (query.next());
         }
+        query.finish();
     }
+
+    if (releasedUrls.isEmpty()) {
+        return;
+    }
+
+    QSqlQuery query = q->prepare(QStringLiteral("DELETE FROM thumbnails WHERE imageUrl = :imageUrl"));
+    query.bindValue(QStringLiteral(":imageUrl"), releasedUrls);
+    if (!query.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete thumbnails:" << query.lastError().text();
+        return;
+    }
+    query.finish();
+
+    removed.files += thumbnailFiles;
 }
 
 QList<SocialImage::ConstPtr> SocialImagesDatabasePrivate::queryImages(int accountId,
@@ -195,7 +477,7 @@ QList<SocialImage::ConstPtr> SocialImagesDatabasePrivate::queryImages(int accoun
     QList<SocialImage::ConstPtr> data;
 
     QString queryString = QLatin1String("SELECT accountId, "
-                                        "imageUrl, imageFile, createdTime, expires, imageId "
+                                        "imageUrl, imageFile, createdTime, expires, imageId, etag, lastModified, contentHash "
                                         "FROM images "
                                         "WHERE accountId = :accountId");
 
@@ -221,7 +503,10 @@ QList<SocialImage::ConstPtr> SocialImagesDatabasePrivate::queryImages(int accoun
                                         query.value(2).toString(),                          // imageFile
                                         QDateTime::fromTime_t(query.value(3).toUInt()),     // createdTime
                                         QDateTime::fromTime_t(query.value(4).toUInt()),     // expires
-                                        query.value(5).toString()));                        // imageId
+                                        query.value(5).toString(),                          // imageId
+                                        query.value(6).toByteArray(),                       // etag
+                                        query.value(7).toByteArray(),                       // lastModified
+                                        query.value(8).toString()));                        // contentHash
     }
 
     return data;
@@ -236,7 +521,7 @@ QList<SocialImage::ConstPtr> SocialImagesDatabasePrivate::queryExpired(int accou
     int currentTime = QDateTime::currentDateTime().toTime_t();
 
     QString queryString = QLatin1String("SELECT accountId, "
-                                        "imageUrl, imageFile, createdTime, expires, imageId "
+                                        "imageUrl, imageFile, createdTime, expires, imageId, etag, lastModified, contentHash "
                                         "FROM images "
                                         "WHERE accountId = :accountId AND expires < :currentTime");
 
@@ -255,7 +540,10 @@ QList<SocialImage::ConstPtr> SocialImagesDatabasePrivate::queryExpired(int accou
                                         query.value(2).toString(),                          // imageFile
                                         QDateTime::fromTime_t(query.value(3).toUInt()),     // createdTime
                                         QDateTime::fromTime_t(query.value(4).toUInt()),     // expires
-                                        query.value(5).toString()));                        // imageId
+                                        query.value(5).toString(),                          // imageId
+                                        query.value(6).toByteArray(),                       // etag
+                                        query.value(7).toByteArray(),                       // lastModified
+                                        query.value(8).toString()));                        // contentHash
     }
 
     return data;
@@ -286,6 +574,16 @@ void SocialImagesDatabase::purgeAccount(int accountId)
     d->queue.purgeAccounts.append(accountId);
 }
 
+// Queues removal of the account's expired images and their files for the
+// next commit(). purgeFinished() is emitted once the write completes.
+void SocialImagesDatabase::purgeExpired(int accountId)
+{
+    Q_D(SocialImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->queue.purgeExpired.append(accountId);
+}
+
 SocialImage::ConstPtr SocialImagesDatabase::image(const QString &imageUrl) const
 {
     Q_D(const SocialImagesDatabase);
@@ -296,7 +594,7 @@ SocialImage::ConstPtr SocialImagesDatabase::image(const QString &imageUrl) const
 
     QSqlQuery query = prepare(
                 "SELECT accountId, "
-                "imageUrl, imageFile, createdTime, expires, imageId "
+                "imageUrl, imageFile, createdTime, expires, imageId, etag, lastModified, contentHash "
                 "FROM images WHERE imageUrl = :imageUrl");
     query.bindValue(":imageUrl", imageUrl);
     if (!query.exec()) {
@@ -314,7 +612,10 @@ SocialImage::ConstPtr SocialImagesDatabase::image(const QString &imageUrl) const
                                query.value(2).toString(),                        // imageFile
                                QDateTime::fromTime_t(query.value(3).toUInt()),   // createdTime
                                QDateTime::fromTime_t(query.value(4).toUInt()),   // expires
-                               query.value(5).toString());                       // imageId
+                               query.value(5).toString(),                        // imageId
+                               query.value(6).toByteArray(),                     // etag
+                               query.value(7).toByteArray(),                     // lastModified
+                               query.value(8).toString());                       // contentHash
 }
 
 SocialImage::ConstPtr SocialImagesDatabase::imageById(const QString &imageId) const
@@ -331,7 +632,7 @@ SocialImage::ConstPtr SocialImagesDatabase::imageById(const QString &imageId) co
 
     QSqlQuery query = prepare(
                 "SELECT accountId, "
-                "imageUrl, imageFile, createdTime, expires, imageId "
+                "imageUrl, imageFile, createdTime, expires, imageId, etag, lastModified, contentHash "
                 "FROM images WHERE imageId = :imageId");
     query.bindValue(":imageId", imageId);
     if (!query.exec()) {
@@ -349,7 +650,60 @@ SocialImage::ConstPtr SocialImagesDatabase::imageById(const QString &imageId) co
                                query.value(2).toString(),                        // imageFile
                                QDateTime::fromTime_t(query.value(3).toUInt()),   // createdTime
                                QDateTime::fromTime_t(query.value(4).toUInt()),   // expires
-                               query.value(5).toString());                       // imageId
+                               query.value(5).toString(),                        // imageId
+                               query.value(6).toByteArray(),                     // etag
+                               query.value(7).toByteArray(),                     // lastModified
+                               query.value(8).toString());                       // contentHash
+}
+
+// Queues eviction of the account's least recently used images for the next
+// commit(), down to maximumBytes of cached files.
+void SocialImagesDatabase::evictImages(int accountId, qint64 maximumBytes)
+{
+    Q_D(SocialImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->queue.evictImages.insert(accountId, qMax<qint64>(0, maximumBytes));
+}
+
+void SocialImagesDatabase::touchImage(const QString &imageUrl)
+{
+    Q_D(SocialImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->queue.touchImages.insert(imageUrl);
+}
+
+void SocialImagesDatabase::addThumbnail(const QString &imageUrl, int size, const QString &thumbnailFile)
+{
+    Q_D(SocialImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    d->queue.insertThumbnails[imageUrl].insert(size, thumbnailFile);
+}
+
+QString SocialImagesDatabase::thumbnailFile(const QString &imageUrl, int size) const
+{
+    Q_D(const SocialImagesDatabase);
+
+    const QMap<int, QString> queued = d->queue.insertThumbnails.value(imageUrl);
+    QMap<int, QString>::const_iterator it = queued.lowerBound(size);
+    if (it != queued.constEnd()) {
+        return it.value();
+    }
+
+    QSqlQuery query = prepare(
+                "SELECT thumbnailFile FROM thumbnails "
+                "WHERE imageUrl = :imageUrl AND size >= :size "
+                "ORDER BY size LIMIT 1");
+    query.bindValue(":imageUrl", imageUrl);
+    query.bindValue(":size", size);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from thumbnails table:" << query.lastError();
+        return QString();
+    }
+
+    return query.next() ? query.value(0).toString() : QString();
 }
 
 void SocialImagesDatabase::removeImage(const QString &imageUrl)
@@ -358,6 +712,7 @@ void SocialImagesDatabase::removeImage(const QString &imageUrl)
     QMutexLocker locker(&d->mutex);
 
     d->queue.insertImages.remove(imageUrl);
+    d->queue.insertThumbnails.remove(imageUrl);
     d->queue.removeImages.append(imageUrl);
 }
 
@@ -368,6 +723,7 @@ void SocialImagesDatabase::removeImages(QList<SocialImage::ConstPtr> images)
 
     foreach (SocialImage::ConstPtr image, images) {
         d->queue.insertImages.remove(image->imageUrl());
+        d->queue.insertThumbnails.remove(image->imageUrl());
         d->queue.removeImages.append(image->imageUrl());
     }
 }
@@ -377,11 +733,15 @@ void SocialImagesDatabase::addImage(int accountId,
                                     const QString &imageFile,
                                     const QDateTime &createdTime,
                                     const QDateTime &expires,
-                                    const QString &imageId)
+                                    const QString &imageId,
+                                    const QByteArray &etag,
+                                    const QByteArray &lastModified,
+                                    const QString &contentHash)
 {
     Q_D(SocialImagesDatabase);
     SocialImage::Ptr image = SocialImage::create(accountId, imageUrl, imageFile,
-                                                 createdTime, expires, imageId);
+                                                 createdTime, expires, imageId,
+                                                 etag, lastModified, contentHash);
     QMutexLocker locker(&d->mutex);
 
     d->queue.removeImages.removeAll(imageUrl);
@@ -427,11 +787,21 @@ bool SocialImagesDatabase::read()
     Q_D(SocialImagesDatabase);
     QMutexLocker locker(&d->mutex);
 
-    if (d->query.queryExpired) {
-        d->query.images = d->queryExpired(d->query.accountId);
-    } else {
-        d->query.images = d->queryImages(d->query.accountId, d->query.olderThan);
-    }
+    const bool queryExpired = d->query.queryExpired;
+    const int accountId = d->query.accountId;
+    const QDateTime olderThan = d->query.olderThan;
+
+    // Don't hold the lock while querying, as that would block the
+    // writer and the callers queueing images.
+    locker.unlock();
+
+    const QList<SocialImage::ConstPtr> images = queryExpired
+            ? d->queryExpired(accountId)
+            : d->queryImages(accountId, olderThan);
+
+    locker.relock();
+    d->query.images = images;
+
     return true;
 }
 
@@ -455,7 +825,11 @@ bool SocialImagesDatabase::write()
     qWarning() << "Queued images being saved:" << d->queue.insertImages.count();
 
     const QList<int> purgeAccounts = d->queue.purgeAccounts;
+    const QList<int> purgeExpired = d->queue.purgeExpired;
+    const QMap<int, qint64> evictImages = d->queue.evictImages;
+    const QSet<QString> touchImages = d->queue.touchImages;
     const QStringList removeImages = d->queue.removeImages;
+    const QMap<QString, QMap<int, QString> > insertThumbnails = d->queue.insertThumbnails;
 
     QList<SocialImage::ConstPtr> insertImages;
     QMap<QString, SocialImage::ConstPtr>::const_iterator i = d->queue.insertImages.constBegin();
@@ -464,38 +838,34 @@ bool SocialImagesDatabase::write()
         ++i;
     }
 
-    d->queue.purgeAccounts.clear();
+    d->queue.touchImages.clear();
     d->queue.removeImages.clear();
+    d->queue.insertThumbnails.clear();
+
+    if (!purgeAccounts.isEmpty() || !purgeExpired.isEmpty() || !evictImages.isEmpty()) {
+        d->purged.pending = true;
+    }
     d->queue.insertImages.clear();
 
     locker.unlock();
 
+    // Left over by a write that was rolled back
+    d->removed.files.clear();
+    d->removed.links.clear();
+    d->removed.imageCount = 0;
+
     bool success = true;
     QSqlQuery query;
 
+    // Purges and evictions remove one batch of rows per transaction, so
+    // that the database is not locked for the whole purge of a large
+    // cache. Unfinished ones stay queued, and writeCommitted() runs the
+    // write again for the next batch.
+    bool purgeFinished = true;
     if (!purgeAccounts.isEmpty()) {
-        QVariantList accountIds;
-        Q_FOREACH (int accountId, purgeAccounts) {
-            accountIds.append(accountId);
-        }
-
-        query = prepare(QStringLiteral(
-                    "SELECT imageFile FROM images "
-                    "WHERE accountId = :accountId"));
-        query.bindValue(QStringLiteral(":accountId"), accountIds);
-        if (!query.exec()) {
-            qWarning() << Q_FUNC_INFO << "Failed to exec images selection query:"
-                       << query.lastError().text();
-            success = false;
-        } else {
-            d->clearCachedImages(query);
-        }
-
-        query = prepare(QStringLiteral(
-                    "DELETE FROM images "
-                    "WHERE accountId = :accountId"));
-        query.bindValue(QStringLiteral(":accountId"), accountIds);
-        executeBatchSocialCacheQuery(query);
+        success = d->purgeImages(purgeAccounts.first(), false, &purgeFinished);
+    } else if (!purgeExpired.isEmpty()) {
+        success = d->purgeImages(purgeExpired.first(), true, &purgeFinished);
     }
 
     if (!removeImages.isEmpty()) {
@@ -504,11 +874,28 @@ bool SocialImagesDatabase::write()
             imageUrls.append(image);
         }
 
+        QSet<QString> contentHashes;
+        query = prepare(QStringLiteral(
+                    "SELECT contentHash FROM images "
+                    "WHERE imageUrl = :imageUrl AND contentHash IS NOT NULL"));
+        Q_FOREACH (const QVariant &imageUrl, imageUrls) {
+            query.bindValue(QStringLiteral(":imageUrl"), imageUrl);
+            if (query.exec()) {
+                while (query.next()) {
+                    contentHashes.insert(query.value(0).toString());
+                }
+            }
+            query.finish();
+        }
+
         query = prepare(QStringLiteral(
                     "DELETE FROM images "
                     "WHERE imageUrl = :imageUrl"));
         query.bindValue(QStringLiteral(":imageUrl"), imageUrls);
         executeBatchSocialCacheQuery(query);
+
+        d->releaseContent(contentHashes);
+        d->releaseThumbnails(removeImages.toSet());
     }
 
     if (!insertImages.isEmpty()) {
@@ -516,6 +903,10 @@ bool SocialImagesDatabase::write()
         QVariantList imageUrls, imageFiles;
         QVariantList createdTimes, expireTimes;
         QVariantList imageIds;
+        QVariantList etags, lastModifieds;
+        QVariantList contentHashes;
+        QVariantList fileSizes, lastAccesses;
+        const uint currentTime = QDateTime::currentDateTime().toTime_t();
 
         Q_FOREACH (const SocialImage::ConstPtr &image, insertImages) {
             accountIds.append(image->accountId());
@@ -524,25 +915,304 @@ bool SocialImagesDatabase::write()
             createdTimes.append(image->createdTime().toTime_t());
             expireTimes.append(image->expires().toTime_t());
             imageIds.append(image->imageId());
+            etags.append(QString::fromLatin1(image->etag()));
+            lastModifieds.append(QString::fromLatin1(image->lastModified()));
+            // A 304 refresh carries no hash; the row keeps the one it has
+            contentHashes.append(image->contentHash().isEmpty()
+                                 ? QVariant(QVariant::String)
+                                 : QVariant(image->contentHash()));
+            fileSizes.append(QFileInfo(image->imageFile()).size());
+            lastAccesses.append(currentTime);
         }
 
         query = prepare(QStringLiteral(
                     "INSERT OR REPLACE INTO images ("
-                    " accountId, imageUrl, imageFile, createdTime, expires, imageId) "
+                    " accountId, imageUrl, imageFile, createdTime, expires, imageId, etag, lastModified, contentHash,"
+                    " fileSize, lastAccess) "
                     "VALUES ("
-                    " :accountId, :imageUrl, :imageFile, :createdTime, :expires, :imageId)"));
+                    " :accountId, :imageUrl, :imageFile, :createdTime, :expires, :imageId, :etag, :lastModified,"
+                    " COALESCE(:contentHash, (SELECT contentHash FROM images"
+                    "  WHERE accountId = :existingAccountId AND imageUrl = :existingImageUrl)),"
+                    " :fileSize, :lastAccess)"));
         query.bindValue(QStringLiteral(":accountId"), accountIds);
         query.bindValue(QStringLiteral(":imageUrl"), imageUrls);
         query.bindValue(QStringLiteral(":imageFile"), imageFiles);
         query.bindValue(QStringLiteral(":createdTime"), createdTimes);
         query.bindValue(QStringLiteral(":expires"), expireTimes);
         query.bindValue(QStringLiteral(":imageId"), imageIds);
+        query.bindValue(QStringLiteral(":etag"), etags);
+        query.bindValue(QStringLiteral(":lastModified"), lastModifieds);
+        query.bindValue(QStringLiteral(":contentHash"), contentHashes);
+        query.bindValue(QStringLiteral(":existingAccountId"), accountIds);
+        query.bindValue(QStringLiteral(":existingImageUrl"), imageUrls);
+        query.bindValue(QStringLiteral(":fileSize"), fileSizes);
+        query.bindValue(QStringLiteral(":lastAccess"), lastAccesses);
         executeBatchSocialCacheQuery(query);
     }
 
+    if (!touchImages.isEmpty()) {
+        QVariantList imageUrls, lastAccesses;
+        const uint currentTime = QDateTime::currentDateTime().toTime_t();
+        Q_FOREACH (const QString &imageUrl, touchImages) {
+            imageUrls.append(imageUrl);
+            lastAccesses.append(currentTime);
+        }
+
+        query = prepare(QStringLiteral(
+                    "UPDATE images SET lastAccess = :lastAccess WHERE imageUrl = :imageUrl"));
+        query.bindValue(QStringLiteral(":lastAccess"), lastAccesses);
+        query.bindValue(QStringLiteral(":imageUrl"), imageUrls);
+        executeBatchSocialCacheQuery(query);
+    }
+
+    // Evict last, so the images just added count against the budget
+    if (purgeAccounts.isEmpty() && purgeExpired.isEmpty() && !evictImages.isEmpty()) {
+        if (!d->evictImages(evictImages.firstKey(), evictImages.first(), &purgeFinished)) {
+            success = false;
+        }
+    }
+
+    if (!insertThumbnails.isEmpty()) {
+        QVariantList imageUrls, sizes, thumbnailFiles;
+
+        QMap<QString, QMap<int, QString> >::const_iterator it = insertThumbnails.constBegin();
+        for (; it != insertThumbnails.constEnd(); ++it) {
+            QMap<int, QString>::const_iterator thumbnail = it->constBegin();
+            for (; thumbnail != it->constEnd(); ++thumbnail) {
+                imageUrls.append(it.key());
+                sizes.append(thumbnail.key());
+                thumbnailFiles.append(thumbnail.value());
+            }
+        }
+
+        query = prepare(QStringLiteral(
+                    "INSERT OR REPLACE INTO thumbnails (imageUrl, size, thumbnailFile) "
+                    "VALUES (:imageUrl, :size, :thumbnailFile)"));
+        query.bindValue(QStringLiteral(":imageUrl"), imageUrls);
+        query.bindValue(QStringLiteral(":size"), sizes);
+        query.bindValue(QStringLiteral(":thumbnailFile"), thumbnailFiles);
+        executeBatchSocialCacheQuery(query);
+    }
+
+    locker.relock();
+
+    // A failed batch is dropped with the rest of the write
+    const bool dequeue = !success || purgeFinished;
+    if (!purgeAccounts.isEmpty()) {
+        if (dequeue) {
+            d->queue.purgeAccounts.removeOne(purgeAccounts.first());
+        }
+    } else if (!purgeExpired.isEmpty()) {
+        if (dequeue) {
+            d->queue.purgeExpired.removeOne(purgeExpired.first());
+        }
+    } else if (!evictImages.isEmpty()) {
+        if (dequeue && d->queue.evictImages.value(evictImages.firstKey(), -1) == evictImages.first()) {
+            d->queue.evictImages.remove(evictImages.firstKey());
+        }
+    }
+    d->purged.continues = success
+            && (!purgeFinished || purgeAccounts.count() + purgeExpired.count() + evictImages.count() > 1);
+
     return success;
 }
 
+// The deletions are committed, so the files they released can go.
+void SocialImagesDatabase::writeCommitted()
+{
+    Q_D(SocialImagesDatabase);
+
+    Q_FOREACH (const QString &file, d->removed.links) {
+        QFile::remove(file);
+    }
+
+    qint64 bytesReclaimed = 0;
+    Q_FOREACH (const QString &file, d->removed.files) {
+        QFileInfo fileInfo(file);
+        if (fileInfo.exists()) {
+            const qint64 size = fileInfo.size();
+            if (QFile::remove(file)) {
+                bytesReclaimed += size;
+            }
+        }
+    }
+
+    const int imageCount = d->removed.imageCount;
+    d->removed.files.clear();
+    d->removed.links.clear();
+    d->removed.imageCount = 0;
+
+    QMutexLocker locker(&d->mutex);
+
+    if (d->purged.pending) {
+        d->purged.imageCount += imageCount;
+        d->purged.bytesReclaimed += bytesReclaimed;
+    }
+
+    const bool continues = d->purged.continues;
+    d->purged.continues = false;
+
+    locker.unlock();
+
+    if (continues) {
+        executeWrite();
+    }
+}
+
+void SocialImagesDatabase::writeFinished()
+{
+    Q_D(SocialImagesDatabase);
+    QMutexLocker locker(&d->mutex);
+
+    if (!d->purged.pending) {
+        return;
+    }
+
+    const int imageCount = d->purged.imageCount;
+    const qint64 bytesReclaimed = d->purged.bytesReclaimed;
+    d->purged.pending = false;
+    d->purged.imageCount = 0;
+    d->purged.bytesReclaimed = 0;
+
+    locker.unlock();
+
+    emit purgeFinished(imageCount, bytesReclaimed);
+}
+
+// Version 5 adds indexes for the image lookups by url and id, and
+// for the per account queries (which also filter on expiry time).
+static bool createImageIndexes(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_imageUrl ON images(imageUrl)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create imageUrl index:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_imageId ON images(imageId)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create imageId index:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_accountId ON images(accountId, expires)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create accountId index:" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+// Shared content is released once no image refers to it, so references
+// are counted by hash.
+static bool createContentHashIndex(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_contentHash ON images(contentHash)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create contentHash index:" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+// Version 8 keeps pre-scaled copies of the images, several per url.
+static bool createThumbnailsTable(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    query.prepare("CREATE TABLE IF NOT EXISTS thumbnails ("
+                  "imageUrl TEXT,"
+                  "size INTEGER,"
+                  "thumbnailFile TEXT,"
+                  "PRIMARY KEY (imageUrl, size))");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create thumbnails table:" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+static bool createLastAccessIndex(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_lastAccess ON images(accountId, lastAccess)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create lastAccess index:" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+// Version 9 keeps one row per account and url, so that sizes add up and
+// evicting a row can't remove a file another row still uses. Older
+// databases may hold duplicates from repeated downloads; the newest wins.
+static bool createUniqueImageIndex(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    if (!query.exec(QStringLiteral(
+                "DELETE FROM images WHERE rowid NOT IN ("
+                " SELECT MAX(rowid) FROM images GROUP BY accountId, imageUrl)"))) {
+        qWarning() << Q_FUNC_INFO << "Unable to remove duplicate images:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE UNIQUE INDEX IF NOT EXISTS images_accountImageUrl ON images(accountId, imageUrl)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create accountId, imageUrl index:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_imageFile ON images(imageFile)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create imageFile index:" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+// Records the size of the files cached before sizes were tracked.
+static bool updateFileSizes(QSqlDatabase database)
+{
+    QSqlQuery query(database);
+
+    if (!query.exec(QStringLiteral("SELECT rowid, imageFile FROM images"))) {
+        qWarning() << Q_FUNC_INFO << "Unable to query image files:" << query.lastError().text();
+        return false;
+    }
+
+    QVariantList rowIds, fileSizes;
+    while (query.next()) {
+        rowIds.append(query.value(0));
+        fileSizes.append(QFileInfo(query.value(1).toString()).size());
+    }
+    query.finish();
+
+    if (rowIds.isEmpty()) {
+        return true;
+    }
+
+    query.prepare(QStringLiteral("UPDATE images SET fileSize = :fileSize WHERE rowid = :rowid"));
+    query.bindValue(QStringLiteral(":fileSize"), fileSizes);
+    query.bindValue(QStringLiteral(":rowid"), rowIds);
+    if (!query.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Unable to update file sizes:" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
 bool SocialImagesDatabase::createTables(QSqlDatabase database) const
 {
     // create the db table
@@ -553,13 +1223,61 @@ bool SocialImagesDatabase::createTables(QSqlDatabase database) const
                   "imageFile TEXT,"
                   "createdTime INTEGER,"
                   "expires INTEGER,"
-                  "imageId STRING)");
+                  "imageId STRING,"
+                  "etag TEXT,"
+                  "lastModified TEXT,"
+                  "contentHash TEXT,"
+                  "fileSize INTEGER,"
+                  "lastAccess INTEGER)");
     if (!query.exec()) {
         qWarning() << Q_FUNC_INFO << "Unable to create images table:" << query.lastError().text();
         return false;
     }
 
-    return true;
+    return createImageIndexes(database)
+            && createContentHashIndex(database)
+            && createThumbnailsTable(database)
+            && createLastAccessIndex(database)
+            && createUniqueImageIndex(database);
+}
+
+bool SocialImagesDatabase::upgradeTables(QSqlDatabase database, int fromVersion) const
+{
+    QSqlQuery query(database);
+
+    switch (fromVersion) {
+    case 4:
+        return createImageIndexes(database);
+    case 5:
+        // Version 6 stores the HTTP validators of each cached file
+        if (!query.exec(QStringLiteral("ALTER TABLE images ADD COLUMN etag TEXT"))
+                || !query.exec(QStringLiteral("ALTER TABLE images ADD COLUMN lastModified TEXT"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add validator columns:" << query.lastError().text();
+            return false;
+        }
+        return true;
+    case 6:
+        // Version 7 links cached files to the shared content store
+        if (!query.exec(QStringLiteral("ALTER TABLE images ADD COLUMN contentHash TEXT"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add contentHash column:" << query.lastError().text();
+            return false;
+        }
+        return createContentHashIndex(database);
+    case 7:
+        return createThumbnailsTable(database);
+    case 8:
+        // Version 9 tracks the size and last use of each file for eviction
+        if (!query.exec(QStringLiteral("ALTER TABLE images ADD COLUMN fileSize INTEGER"))
+                || !query.exec(QStringLiteral("ALTER TABLE images ADD COLUMN lastAccess INTEGER DEFAULT 0"))) {
+            qWarning() << Q_FUNC_INFO << "Unable to add eviction columns:" << query.lastError().text();
+            return false;
+        }
+        return createUniqueImageIndex(database)
+                && updateFileSizes(database)
+                && createLastAccessIndex(database);
+    default:
+        return false;
+    }
 }
 
 bool SocialImagesDatabase::dropTables(QSqlDatabase database) const
@@ -571,5 +1289,11 @@ bool SocialImagesDatabase::dropTables(QSqlDatabase database) const
         return false;
     }
 
+    query.prepare("DROP TABLE IF EXISTS thumbnails");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete thumbnails table:" << query.lastError().text();
+        return false;
+    }
+
     return true;
 }
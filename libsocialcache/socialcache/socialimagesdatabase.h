@@ -39,7 +39,10 @@ public:
                                    const QString &imageFile,
                                    const QDateTime &createdTime,
                                    const QDateTime &expires,
-                                   const QString &imageId);
+                                   const QString &imageId,
+                                   const QByteArray &etag = QByteArray(),
+                                   const QByteArray &lastModified = QByteArray(),
+                                   const QString &contentHash = QString());
 
     int accountId() const;
     QString imageUrl() const;
@@ -48,6 +51,13 @@ public:
     QDateTime expires() const;
     QString imageId() const;
 
+    // HTTP validators of the cached file, used to revalidate it once expired
+    QByteArray etag() const;
+    QByteArray lastModified() const;
+
+    // Hash of the file content when it is a link to the shared content store
+    QString contentHash() const;
+
 protected:
     QScopedPointer<SocialImagePrivate> d_ptr;
 
@@ -58,7 +68,10 @@ private:
                          const QString & imageFile,
                          const QDateTime &createdTime,
                          const QDateTime &expires,
-                         const QString &imageId);
+                         const QString &imageId,
+                         const QByteArray &etag,
+                         const QByteArray &lastModified,
+                         const QString &contentHash);
 };
 
 bool operator==(const SocialImage::ConstPtr &image1, const SocialImage::ConstPtr &image2);
@@ -73,6 +86,10 @@ public:
     ~SocialImagesDatabase();
 
     void purgeAccount(int accountId);
+    void purgeExpired(int accountId);
+    // Removes the account's least recently used images until their files
+    // take at most maximumBytes. Reported through purgeFinished() like purges.
+    void evictImages(int accountId, qint64 maximumBytes);
     SocialImage::ConstPtr image(const QString &imageUrl) const;
     SocialImage::ConstPtr imageById(const QString &imageId) const;
     void addImage(int accountId,
@@ -80,7 +97,16 @@ public:
                   const QString & imageFile,
                   const QDateTime &createdTime,
                   const QDateTime &expires,
-                  const QString & imageId = QString());
+                  const QString & imageId = QString(),
+                  const QByteArray &etag = QByteArray(),
+                  const QByteArray &lastModified = QByteArray(),
+                  const QString &contentHash = QString());
+    // Thumbnails are removed together with the last image of their url
+    void addThumbnail(const QString &imageUrl, int size, const QString &thumbnailFile);
+    // Smallest thumbnail at least size pixels across, or empty if none
+    QString thumbnailFile(const QString &imageUrl, int size) const;
+    // Marks the image as used now, so eviction keeps it longer
+    void touchImage(const QString &imageUrl);
     void removeImage(const QString &imageUrl);
     void removeImages(QList<SocialImage::ConstPtr> images);
     void queryImages(int accountId, const QDateTime &olderThan = QDateTime());
@@ -91,14 +117,18 @@ public:
 
 Q_SIGNALS:
     void queryFinished();
+    void purgeFinished(int imageCount, qint64 bytesReclaimed);
 
 protected:
     bool read();
     void readFinished();
 
     bool write();
+    void writeFinished();
+    void writeCommitted();
     bool createTables(QSqlDatabase database) const;
     bool dropTables(QSqlDatabase database) const;
+    bool upgradeTables(QSqlDatabase database, int fromVersion) const;
 
 
 private:
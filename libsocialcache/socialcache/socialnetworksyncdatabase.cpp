@@ -136,6 +136,18 @@ void SocialNetworkSyncDatabase::addSyncTimestamp(const QString &serviceName,
 
     QMutexLocker locker(&d->mutex);
 
+    // Only the latest timestamp of each account, service and data type is kept,
+    // so repeated updates between two commits collapse into one row.
+    for (int i = 0; i < d->queuedData.count(); ++i) {
+        SocialNetworkSyncData *queued = d->queuedData.at(i);
+        if (queued->accountId == accountId
+                && queued->serviceName == serviceName
+                && queued->dataType == dataType) {
+            delete d->queuedData.takeAt(i);
+            break;
+        }
+    }
+
     d->queuedData.append(data);
 }
 
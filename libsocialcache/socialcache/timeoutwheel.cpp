@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "timeoutwheel.h"
+
+#include <QtCore/QPointer>
+
+// Timeouts further away than this many slots go around the wheel again
+static const int WHEEL_SIZE = 64;
+
+TimeoutWheel::TimeoutWheel(int resolution, QObject *parent)
+    : QObject(parent)
+    , m_resolution(qMax(1, resolution))
+    , m_slots(WHEEL_SIZE)
+    , m_lastTick(0)
+    , m_expireAll(false)
+    , m_timer(this)
+{
+    m_clock.start();
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+TimeoutWheel::~TimeoutWheel()
+{
+}
+
+quint64 TimeoutWheel::currentTick() const
+{
+    return m_clock.elapsed() / m_resolution;
+}
+
+void TimeoutWheel::start(QObject *object, int msecs)
+{
+    if (!object) {
+        return;
+    }
+
+    if (m_deadlines.contains(object)) {
+        remove(object);
+    } else {
+        connect(object, SIGNAL(destroyed(QObject*)), this, SLOT(objectDestroyed(QObject*)));
+    }
+
+    // Round up, so no timeout fires early
+    const quint64 deadline = (m_clock.elapsed() + qMax(0, msecs) + m_resolution - 1) / m_resolution;
+    m_deadlines.insert(object, deadline);
+    m_slots[deadline % WHEEL_SIZE].insert(object);
+
+    if (!m_timer.isActive()) {
+        m_lastTick = currentTick();
+        m_timer.start(m_resolution);
+    }
+}
+
+void TimeoutWheel::stop(QObject *object)
+{
+    if (m_deadlines.contains(object)) {
+        remove(object);
+        disconnect(object, SIGNAL(destroyed(QObject*)), this, SLOT(objectDestroyed(QObject*)));
+    }
+}
+
+bool TimeoutWheel::isActive(QObject *object) const
+{
+    return m_deadlines.contains(object);
+}
+
+int TimeoutWheel::count() const
+{
+    return m_deadlines.count();
+}
+
+void TimeoutWheel::expireAll()
+{
+    if (m_deadlines.isEmpty()) {
+        return;
+    }
+
+    m_expireAll = true;
+    m_timer.start(0);
+}
+
+void TimeoutWheel::remove(QObject *object)
+{
+    const quint64 deadline = m_deadlines.take(object);
+    m_slots[deadline % WHEEL_SIZE].remove(object);
+    if (m_deadlines.isEmpty()) {
+        m_timer.stop();
+        m_expireAll = false;
+    }
+}
+
+void TimeoutWheel::objectDestroyed(QObject *object)
+{
+    if (m_deadlines.contains(object)) {
+        remove(object);
+    }
+}
+
+void TimeoutWheel::tick()
+{
+    const quint64 now = currentTick();
+
+    QList<QPointer<QObject> > expired;
+    if (m_expireAll) {
+        m_expireAll = false;
+        Q_FOREACH (QObject *object, m_deadlines.keys()) {
+            expired.append(object);
+        }
+    } else {
+        // Visit each slot passed since the last tick, at most once around
+        const quint64 first = qMax(m_lastTick + 1, now >= WHEEL_SIZE ? now - WHEEL_SIZE + 1 : 0);
+        for (quint64 slot = first; slot <= now; ++slot) {
+            Q_FOREACH (QObject *object, m_slots[slot % WHEEL_SIZE]) {
+                if (m_deadlines.value(object) <= now) {
+                    expired.append(object);
+                }
+            }
+        }
+    }
+    m_lastTick = now;
+
+    Q_FOREACH (const QPointer<QObject> &object, expired) {
+        stop(object);
+    }
+
+    if (!m_deadlines.isEmpty() && m_timer.interval() != m_resolution) {
+        m_timer.start(m_resolution);
+    }
+
+    // Handlers may delete objects that have not been reported yet
+    Q_FOREACH (const QPointer<QObject> &object, expired) {
+        if (object) {
+            emit timeout(object);
+        }
+    }
+}
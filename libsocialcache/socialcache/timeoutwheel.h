@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TIMEOUTWHEEL_H
+#define TIMEOUTWHEEL_H
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+// Coarse timeouts for many objects, such as network replies, driven by a
+// single timer. Timeouts are kept in a hashed wheel of resolution-sized
+// slots, so starting and stopping one is O(1); each fires up to one
+// resolution late. Objects are forgotten when destroyed.
+class TimeoutWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TimeoutWheel(int resolution = 1000, QObject *parent = 0);
+    ~TimeoutWheel();
+
+    // Starts, or restarts, the timeout of object
+    void start(QObject *object, int msecs);
+    void stop(QObject *object);
+    bool isActive(QObject *object) const;
+    int count() const;
+
+    // Times every object out from the event loop, as soon as possible
+    void expireAll();
+
+Q_SIGNALS:
+    void timeout(QObject *object);
+
+private Q_SLOTS:
+    void tick();
+    void objectDestroyed(QObject *object);
+
+private:
+    quint64 currentTick() const;
+    void remove(QObject *object);
+
+    const int m_resolution;
+    QVector<QSet<QObject *> > m_slots;
+    QHash<QObject *, quint64> m_deadlines;  // tick each object times out at
+    QElapsedTimer m_clock;
+    quint64 m_lastTick;
+    bool m_expireAll;
+    QTimer m_timer;
+};
+
+#endif // TIMEOUTWHEEL_H
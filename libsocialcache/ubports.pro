@@ -15,6 +15,7 @@ HEADERS = \
     socialcache/abstractsocialcachedatabase_p.h \
     socialcache/socialnetworksyncdatabase.h \
     socialcache/socialimagesdatabase.h \
+    socialcache/timeoutwheel.h \
 
 
 SOURCES = \
@@ -24,8 +25,12 @@ SOURCES = \
     socialcache/abstractsocialcachedatabase.cpp \
     socialcache/socialnetworksyncdatabase.cpp \
     socialcache/socialimagesdatabase.cpp \
+    socialcache/timeoutwheel.cpp \
 
 
+# ProcessMutex times out contended locks with a POSIX timer
+LIBS += -lrt
+
 QMAKE_PKGCONFIG_NAME = lib$$TARGET
 QMAKE_PKGCONFIG_DESCRIPTION = Social cache development files
 QMAKE_PKGCONFIG_LIBDIR = $$OUT_PWD
@@ -37,6 +37,7 @@ A Buteo plugin which provides data synchronization with various social services.
 %{_libdir}/buteo-plugins-qt5/oopp/libsociald-client.so
 %config %{_sysconfdir}/buteo/profiles/client/sociald.xml
 %config %{_sysconfdir}/buteo/profiles/sync/sociald.All.xml
+%config %{_sysconfdir}/buteo/sociald.All.ini
 %{_libdir}/libsyncpluginscommon.so.*
 %exclude %{_libdir}/libsyncpluginscommon.so
 %license COPYING
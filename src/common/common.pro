@@ -14,13 +14,18 @@ TARGET = $$qtLibraryTarget($$TARGET)
 
 HEADERS += \
     $$PWD/buteosyncfw_p.h \
+    $$PWD/jsonstreamreader.h \
     $$PWD/socialdbuteoplugin.h \
     $$PWD/socialnetworksyncadaptor.h \
+    $$PWD/synctrace.h \
+    $$PWD/synctrace_p.h \
     $$PWD/trace.h
 
 SOURCES += \
+    $$PWD/jsonstreamreader.cpp \
     $$PWD/socialdbuteoplugin.cpp \
-    $$PWD/socialnetworksyncadaptor.cpp
+    $$PWD/socialnetworksyncadaptor.cpp \
+    $$PWD/synctrace.cpp
 
 HEADERS += $$PWD/socialdnetworkaccessmanager_p.h
 
@@ -0,0 +1,246 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#include "jsonstreamreader.h"
+
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonParseError>
+
+namespace {
+    inline bool isJsonWhitespace(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+}
+
+JsonStreamReader::JsonStreamReader(const QString &arrayKey, QObject *parent)
+    : QObject(parent)
+    , m_arrayKey(arrayKey.toUtf8())
+    , m_elementType(NoElement)
+    , m_elementStart(-1)
+    , m_elementCount(0)
+    , m_depth(0)
+    , m_inString(false)
+    , m_inKey(false)
+    , m_escape(false)
+    , m_expectKey(false)
+    , m_streaming(false)
+    , m_arrayDone(false)
+    , m_error(false)
+{
+}
+
+/*
+    Scans the new data.  Bytes outside the streamed array are copied to the
+    skeleton which remainder() is parsed from; each array element is parsed
+    on its own as soon as its last byte has arrived.
+*/
+bool JsonStreamReader::addData(const QByteArray &data)
+{
+    if (m_error) {
+        return false;
+    }
+
+    const int scanFrom = m_buffer.size();
+    m_buffer.append(data);
+    const char *bytes = m_buffer.constData();
+
+    for (int i = scanFrom; i < m_buffer.size() && !m_error; ++i) {
+        const char c = bytes[i];
+
+        // numbers and literals end at the first byte which isn't part of them
+        if (m_elementType == ScalarElement
+                && (c == ',' || c == ']' || isJsonWhitespace(c))) {
+            addElement(i);
+        }
+
+        if (m_streaming && m_depth == 2 && m_elementType == NoElement
+                && !m_inString && c != ',' && c != ']' && !isJsonWhitespace(c)) {
+            m_elementStart = i;
+            m_elementType = (c == '{' || c == '[') ? ContainerElement
+                          : (c == '"') ? StringElement
+                          : ScalarElement;
+        }
+
+        // separators within the streamed array are dropped along with the elements
+        const bool skip = m_elementType != NoElement
+                || (m_streaming && m_depth == 2 && c != ']');
+        if (!skip) {
+            m_skeleton.append(c);
+        }
+
+        if (m_inString) {
+            if (m_escape) {
+                m_escape = false;
+            } else if (c == '\\') {
+                m_escape = true;
+            } else if (c == '"') {
+                m_inString = false;
+                m_inKey = false;
+                if (m_elementType == StringElement && m_depth == 2) {
+                    addElement(i + 1);
+                }
+                continue;
+            }
+            if (m_inKey) {
+                m_key.append(c);
+            }
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            m_inString = true;
+            if (m_depth == 1 && m_expectKey) {
+                m_inKey = true;
+                m_key.clear();
+            }
+            break;
+        case '{':
+        case '[':
+            if (m_depth == 0 && c != '{') {
+                m_error = true;
+                break;
+            }
+            if (m_depth == 1 && !m_expectKey && c == '[' && !m_arrayDone && m_key == m_arrayKey) {
+                m_streaming = true;
+            }
+            if (++m_depth == 1) {
+                m_expectKey = true;
+            }
+            break;
+        case '}':
+        case ']':
+            if (--m_depth < 0) {
+                m_error = true;
+                break;
+            }
+            if (m_streaming) {
+                if (m_depth == 2 && m_elementType == ContainerElement) {
+                    addElement(i + 1);
+                } else if (m_depth == 1) {
+                    m_streaming = false;
+                    m_arrayDone = true;
+                }
+            }
+            break;
+        case ':':
+            if (m_depth == 1) {
+                m_expectKey = false;
+            }
+            break;
+        case ',':
+            if (m_depth == 1) {
+                m_expectKey = true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // keep only the bytes of the element still being received
+    if (m_elementType != NoElement) {
+        m_buffer.remove(0, m_elementStart);
+        m_elementStart = 0;
+    } else {
+        m_buffer.clear();
+    }
+
+    return !m_error;
+}
+
+void JsonStreamReader::addElement(int end)
+{
+    const QByteArray element = QByteArray::fromRawData(m_buffer.constData() + m_elementStart,
+                                                       end - m_elementStart);
+    QJsonParseError parseError;
+    if (m_elementType == ContainerElement) {
+        const QJsonDocument document = QJsonDocument::fromJson(element, &parseError);
+        if (document.isObject()) {
+            m_elements.append(document.object());
+        } else {
+            m_elements.append(document.array());
+        }
+    } else {
+        // QJsonDocument only parses objects and arrays
+        const QJsonDocument document = QJsonDocument::fromJson('[' + element + ']', &parseError);
+        m_elements.append(document.array().at(0));
+    }
+
+    if (parseError.error != QJsonParseError::NoError) {
+        m_elements.removeLast();
+        m_error = true;
+    } else {
+        ++m_elementCount;
+    }
+
+    m_elementType = NoElement;
+    m_elementStart = -1;
+}
+
+bool JsonStreamReader::readElement(QJsonValue *element)
+{
+    if (m_elements.isEmpty()) {
+        return false;
+    }
+
+    *element = m_elements.takeFirst();
+    return true;
+}
+
+bool JsonStreamReader::finish()
+{
+    if (m_elementType == ScalarElement) {
+        addElement(m_buffer.size());
+    }
+
+    if (m_error || m_inString || m_depth != 0 || m_elementType != NoElement) {
+        m_error = true;
+        return false;
+    }
+
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(m_skeleton, &parseError);
+    m_skeleton.clear();
+    if (parseError.error != QJsonParseError::NoError || !document.isObject()) {
+        m_error = true;
+        return false;
+    }
+
+    m_remainder = document.object();
+    return true;
+}
+
+bool JsonStreamReader::hasError() const
+{
+    return m_error;
+}
+
+int JsonStreamReader::elementCount() const
+{
+    return m_elementCount;
+}
+
+QJsonObject JsonStreamReader::remainder() const
+{
+    return m_remainder;
+}
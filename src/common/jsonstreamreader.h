@@ -0,0 +1,87 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#ifndef JSONSTREAMREADER_H
+#define JSONSTREAMREADER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QJsonObject>
+#include <QtCore/QJsonValue>
+#include <QtCore/QList>
+
+/*
+    Reads a JSON object as it arrives and hands out the elements of one of
+    its top-level arrays (e.g. "items" or "data") one at a time, so a large
+    page of results never has to be held as raw bytes and a whole document
+    tree at once. Only the bytes of the element being received are buffered.
+
+    Everything else in the object (paging data, sync tokens) is returned by
+    remainder() once finish() has been called, with the streamed array left
+    empty.  The reader can be parented to the network reply it reads from.
+*/
+class JsonStreamReader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit JsonStreamReader(const QString &arrayKey, QObject *parent = 0);
+
+    // Returns false once the data is found to be malformed
+    bool addData(const QByteArray &data);
+    // Takes the next complete array element, if any
+    bool readElement(QJsonValue *element);
+    // Returns true if the data added made up one valid JSON object
+    bool finish();
+
+    bool hasError() const;
+    int elementCount() const;
+    QJsonObject remainder() const;
+
+private:
+    enum ElementType {
+        NoElement = 0,
+        ContainerElement,
+        StringElement,
+        ScalarElement
+    };
+
+    void addElement(int end);
+
+    QByteArray m_arrayKey;
+    QByteArray m_buffer;
+    QByteArray m_skeleton;
+    QByteArray m_key;
+    QList<QJsonValue> m_elements;
+    QJsonObject m_remainder;
+    ElementType m_elementType;
+    int m_elementStart;
+    int m_elementCount;
+    int m_depth;
+    bool m_inString;
+    bool m_inKey;
+    bool m_escape;
+    bool m_expectKey;
+    bool m_streaming;
+    bool m_arrayDone;
+    bool m_error;
+};
+
+#endif // JSONSTREAMREADER_H
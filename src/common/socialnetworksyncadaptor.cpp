@@ -24,6 +24,8 @@
 #include "trace.h"
 
 #include <QtCore/QJsonDocument>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
 #include <QtCore/QTimer>
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
@@ -43,8 +45,16 @@
 // libsocialcache
 #include <socialcache/socialimagesdatabase.h>
 #include <socialcache/socialnetworksyncdatabase.h>
+#include <socialcache/timeoutwheel.h>
 
 namespace {
+    // Sync timestamp updates arriving within this many milliseconds share one transaction
+    const int SYNC_TIMESTAMP_COMMIT_DELAY = 200;
+
+    // Cached images of one account may take this many MiB unless configured
+    // otherwise in imagecache.ini, see imageCacheBudget()
+    const int DEFAULT_IMAGE_CACHE_BUDGET = 256;
+
     QStringList validDataTypesInitialiser()
     {
         return QStringList()
@@ -73,15 +83,25 @@ SocialNetworkSyncAdaptor::SocialNetworkSyncAdaptor(const QString &serviceName,
     , m_networkAccessManager(qnam != 0 ? qnam : new SocialdNetworkAccessManager)
     , m_accountSyncProfile(NULL)
     , m_syncDb(new SocialNetworkSyncDatabase())
+    , m_syncDbCommitTimer(new QTimer(this))
     , m_status(SocialNetworkSyncAdaptor::Invalid)
     , m_enabled(false)
     , m_syncAborted(false)
     , m_serviceName(serviceName)
+    , m_replyTimeouts(new TimeoutWheel(1000, this))
+    , m_syncStarted(0)
 {
+    connect(m_replyTimeouts, SIGNAL(timeout(QObject*)), this, SLOT(timeoutReply(QObject*)));
+    SyncTrace::registerDBusObject();
+
+    m_syncDbCommitTimer->setSingleShot(true);
+    m_syncDbCommitTimer->setInterval(SYNC_TIMESTAMP_COMMIT_DELAY);
+    connect(m_syncDbCommitTimer, SIGNAL(timeout()), this, SLOT(commitSyncTimestamps()));
 }
 
 SocialNetworkSyncAdaptor::~SocialNetworkSyncAdaptor()
 {
+    flushSyncTimestamps();
     delete m_networkAccessManager;
     delete m_accountSyncProfile;
     delete m_syncDb;
@@ -202,18 +222,44 @@ QDateTime SocialNetworkSyncAdaptor::lastSyncTimestamp(const QString &serviceName
 /*!
     \internal
     Updates the last sync timestamp for the given service, account and data type to the given \a timestamp.
+    Updates arriving within a short window are committed together in one transaction; they are
+    flushed to disk before the adaptor reports that the sync has finished.
 */
-bool SocialNetworkSyncAdaptor::updateLastSyncTimestamp(const QString &serviceName,
+void SocialNetworkSyncAdaptor::updateLastSyncTimestamp(const QString &serviceName,
                                                        const QString &dataType,
                                                        int accountId,
                                                        const QDateTime &timestamp)
 {
-    // Workaround
-    // TODO: do better, with a queue
     m_syncDb->addSyncTimestamp(serviceName, dataType, accountId, timestamp);
+    if (!m_syncDbCommitTimer->isActive()) {
+        m_syncDbCommitTimer->start();
+    }
+}
+
+void SocialNetworkSyncAdaptor::commitSyncTimestamps()
+{
     m_syncDb->commit();
+}
+
+/*!
+    \internal
+    Commits any queued sync timestamps and blocks until they are on disk.
+    Returns false if the write failed.
+*/
+bool SocialNetworkSyncAdaptor::flushSyncTimestamps()
+{
+    if (m_syncDbCommitTimer->isActive()) {
+        m_syncDbCommitTimer->stop();
+        m_syncDb->commit();
+    }
+
     m_syncDb->wait();
-    return m_syncDb->writeStatus() == AbstractSocialCacheDatabase::Finished;
+
+    if (m_syncDb->writeStatus() == AbstractSocialCacheDatabase::Error) {
+        SOCIALD_LOG_ERROR("failed to store" << m_serviceName << dataTypeName(m_dataType) << "sync timestamps");
+        return false;
+    }
+    return true;
 }
 
 /*!
@@ -233,6 +279,10 @@ QList<int> SocialNetworkSyncAdaptor::syncedAccounts(const QString &dataType)
 void SocialNetworkSyncAdaptor::setStatus(Status status)
 {
     if (m_status != status) {
+        if (status == SocialNetworkSyncAdaptor::Busy && !m_syncTimer.isValid()) {
+            m_syncTimer.start();
+            m_syncStarted = QDateTime::currentMSecsSinceEpoch();
+        }
         m_status = status;
         emit statusChanged();
     }
@@ -264,12 +314,41 @@ void SocialNetworkSyncAdaptor::setInitialActive(bool enabled)
  */
 void SocialNetworkSyncAdaptor::setFinishedInactive()
 {
-    finalCleanup();
+    {
+        SyncTraceScope span(SyncTrace::Finalize, traceOwner(), 0, QStringLiteral("finalCleanup"));
+        finalCleanup();
+    }
+    if (!flushSyncTimestamps()) {
+        // the next sync would fetch the same data again
+        setStatus(SocialNetworkSyncAdaptor::Error);
+    }
     SOCIALD_LOG_INFO("Finished" << m_serviceName << SocialNetworkSyncAdaptor::dataTypeName(m_dataType) <<
                      "sync at:" << QDateTime::currentDateTime().toString(Qt::ISODate));
+    finishSyncTrace();
     setStatus(SocialNetworkSyncAdaptor::Inactive);
 }
 
+/*!
+ * \internal
+ * Records the span of the whole sync and, if SOCIALD_SYNC_TRACE_FILE is set,
+ * appends the spans recorded during it to that file.
+ */
+void SocialNetworkSyncAdaptor::finishSyncTrace()
+{
+    if (!m_syncTimer.isValid()) {
+        return;
+    }
+
+    SyncTrace::record(SyncTrace::Sync, traceOwner(), 0, m_syncTimer, -1,
+                      m_status == SocialNetworkSyncAdaptor::Error ? -1 : 0);
+    m_syncTimer.invalidate();
+
+    const QString fileName = QString::fromLocal8Bit(qgetenv("SOCIALD_SYNC_TRACE_FILE"));
+    if (!fileName.isEmpty()) {
+        SyncTrace::appendToFile(fileName, SyncTrace::spans(traceOwner(), m_syncStarted));
+    }
+}
+
 void SocialNetworkSyncAdaptor::incrementSemaphore(int accountId)
 {
     int semaphoreValue = m_accountSyncSemaphores.value(accountId);
@@ -295,7 +374,10 @@ void SocialNetworkSyncAdaptor::decrementSemaphore(int accountId)
     m_accountSyncSemaphores.insert(accountId, semaphoreValue);
 
     if (semaphoreValue == 0) {
-        finalize(accountId);
+        {
+            SyncTraceScope span(SyncTrace::Finalize, traceOwner(), accountId, QStringLiteral("finalize"));
+            finalize(accountId);
+        }
 
         // With the newer implementation, in finalize we can rereaise semaphores,
         // so if after calling finalize, the semaphore count is not the same anymore,
@@ -327,15 +409,17 @@ void SocialNetworkSyncAdaptor::decrementSemaphore(int accountId)
     }
 }
 
-void SocialNetworkSyncAdaptor::timeoutReply()
+void SocialNetworkSyncAdaptor::timeoutReply(QObject *object)
 {
-    QTimer *timer = qobject_cast<QTimer*>(sender());
-    QNetworkReply *reply = timer->property("networkReply").value<QNetworkReply*>();
-    int accountId = timer->property("accountId").toInt();
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(object);
+    int accountId = m_replyTimeoutAccounts.take(object);
+    if (!reply) {
+        return;
+    }
 
     SOCIALD_LOG_ERROR("network request timed out while performing sync with account" << accountId);
+    finishTraceSpan(reply, -1);
 
-    m_networkReplyTimeouts[accountId].remove(reply);
     reply->setProperty("isError", QVariant::fromValue<bool>(true));
     reply->finished(); // invoke finished, so that the error handling there decrements the semaphore etc.
     reply->disconnect();
@@ -344,59 +428,114 @@ void SocialNetworkSyncAdaptor::timeoutReply()
 void SocialNetworkSyncAdaptor::setupReplyTimeout(int accountId, QNetworkReply *reply, int msecs)
 {
     // this function should be called whenever a new network request is performed.
-    QTimer *timer = new QTimer(this);
-    timer->setSingleShot(true);
-    timer->setInterval(msecs);
-    timer->setProperty("accountId", accountId);
-    timer->setProperty("networkReply", QVariant::fromValue<QNetworkReply*>(reply));
-    connect(timer, SIGNAL(timeout()), this, SLOT(timeoutReply()));
-    timer->start();
-    m_networkReplyTimeouts[accountId].insert(reply, timer);
+    m_replyTimeouts->start(reply, msecs);
+    m_replyTimeoutAccounts.insert(reply, accountId);
+
+    if (SyncTrace::isEnabled()) {
+        startTraceSpan(SyncTrace::Request, accountId, reply,
+                       reply->url().toString(QUrl::RemoveUserInfo | QUrl::RemoveQuery));
+        connect(reply, SIGNAL(downloadProgress(qint64,qint64)),
+                this, SLOT(traceReplyProgress(qint64,qint64)), Qt::UniqueConnection);
+    }
 }
 
 void SocialNetworkSyncAdaptor::removeReplyTimeout(int accountId, QNetworkReply *reply)
 {
     // this function should be called by the finished() handler for the reply.
-    QTimer *timer = m_networkReplyTimeouts[accountId].value(reply);
     if (!reply) {
         return;
     }
 
-    delete timer;
-    m_networkReplyTimeouts[accountId].remove(reply);
+    m_replyTimeouts->stop(reply);
+    m_replyTimeoutAccounts.remove(reply);
+
+    // the handler usually parses the reply next; attribute that to us
+    SyncTrace::setCurrentContext(traceOwner(), accountId);
+    finishTraceSpan(reply, reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
 }
 
 void SocialNetworkSyncAdaptor::triggerReplyTimeouts()
 {
     // if we've lost network connectivity, we should immediately timeout all replies.
-    Q_FOREACH (int accountId, m_networkReplyTimeouts.keys()) {
-        Q_FOREACH (QTimer *timer, m_networkReplyTimeouts[accountId]) {
-            timer->stop();
-            timer->setInterval(1);
-            timer->start();
-        }
+    m_replyTimeouts->expireAll();
+}
+
+QString SocialNetworkSyncAdaptor::traceOwner() const
+{
+    return m_serviceName + QLatin1Char('.') + dataTypeName(m_dataType);
+}
+
+/*!
+    \internal
+    Starts timing an asynchronous operation, such as a sign-on session,
+    which is identified by \a key until finishTraceSpan() is called with it.
+*/
+void SocialNetworkSyncAdaptor::startTraceSpan(SyncTrace::Phase phase, int accountId, QObject *key,
+                                              const QString &detail)
+{
+    if (!SyncTrace::isEnabled() || !key) {
+        return;
     }
+
+    PendingTraceSpan &span = m_traceSpans[key];
+    span.timer.start();
+    span.detail = detail;
+    span.bytes = -1;
+    span.phase = phase;
+    span.accountId = accountId;
+    connect(key, SIGNAL(destroyed(QObject*)), this, SLOT(traceSpanDestroyed(QObject*)), Qt::UniqueConnection);
+}
+
+void SocialNetworkSyncAdaptor::finishTraceSpan(QObject *key, int status)
+{
+    QHash<QObject *, PendingTraceSpan>::iterator it = m_traceSpans.find(key);
+    if (it == m_traceSpans.end()) {
+        return;
+    }
+
+    SyncTrace::record(it->phase, traceOwner(), it->accountId, it->timer, it->bytes, status, it->detail);
+    m_traceSpans.erase(it);
+}
+
+void SocialNetworkSyncAdaptor::traceReplyProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+    Q_UNUSED(bytesTotal)
+    QHash<QObject *, PendingTraceSpan>::iterator it = m_traceSpans.find(sender());
+    if (it != m_traceSpans.end()) {
+        it->bytes = bytesReceived;
+    }
+}
+
+void SocialNetworkSyncAdaptor::traceSpanDestroyed(QObject *key)
+{
+    m_traceSpans.remove(key);
 }
 
 QJsonObject SocialNetworkSyncAdaptor::parseJsonObjectReplyData(const QByteArray &replyData, bool *ok)
 {
+    SyncTraceScope span(SyncTrace::Parse, SyncTrace::currentOwner(), SyncTrace::currentAccountId());
+    span.setBytes(replyData.size());
     QJsonDocument jsonDocument = QJsonDocument::fromJson(replyData);
     *ok = !jsonDocument.isEmpty();
     if (*ok && jsonDocument.isObject()) {
         return jsonDocument.object();
     }
     *ok = false;
+    span.setStatus(-1);
     return QJsonObject();
 }
 
 QJsonArray SocialNetworkSyncAdaptor::parseJsonArrayReplyData(const QByteArray &replyData, bool *ok)
 {
+    SyncTraceScope span(SyncTrace::Parse, SyncTrace::currentOwner(), SyncTrace::currentAccountId());
+    span.setBytes(replyData.size());
     QJsonDocument jsonDocument = QJsonDocument::fromJson(replyData);
     *ok = !jsonDocument.isEmpty();
     if (*ok && jsonDocument.isArray()) {
         return jsonDocument.array();
     }
     *ok = false;
+    span.setStatus(-1);
     return QJsonArray();
 }
 
@@ -436,36 +575,52 @@ QString SocialNetworkSyncAdaptor::dataTypeName(SocialNetworkSyncAdaptor::DataTyp
     return QString();
 }
 
+// Removes all cached images of the account. The files are unlinked and the rows
+// deleted on the database writer thread; completion is logged from imagesPurged().
 void SocialNetworkSyncAdaptor::purgeCachedImages(SocialImagesDatabase *database,
                                                  int accountId)
 {
-    database->queryImages(accountId);
-    database->wait();
-
-    QList<SocialImage::ConstPtr> images = database->images();
-    foreach (SocialImage::ConstPtr image, images) {
-        SOCIALD_LOG_DEBUG("Purge cached image " << image->imageFile() << " for account " << image->accountId());
-        QFile::remove(image->imageFile());
-    }
-
-    database->removeImages(images);
+    SOCIALD_LOG_DEBUG("Purge cached images for account" << accountId);
+    connect(database, SIGNAL(purgeFinished(int,qint64)),
+            this, SLOT(imagesPurged(int,qint64)), Qt::UniqueConnection);
+    database->purgeAccount(accountId);
     database->commit();
-    database->wait();
 }
 
+// Removes the account's expired images, then its least recently used ones
+// beyond the service's budget.
 void SocialNetworkSyncAdaptor::purgeExpiredImages(SocialImagesDatabase *database,
                                                   int accountId)
 {
-    database->queryExpired(accountId);
-    database->wait();
-
-    QList<SocialImage::ConstPtr> images = database->images();
-    foreach (SocialImage::ConstPtr image, images) {
-        SOCIALD_LOG_DEBUG("Purge expired image " << image->imageFile() << " for account " << image->accountId());
-        QFile::remove(image->imageFile());
+    SOCIALD_LOG_DEBUG("Purge expired images for account" << accountId);
+    connect(database, SIGNAL(purgeFinished(int,qint64)),
+            this, SLOT(imagesPurged(int,qint64)), Qt::UniqueConnection);
+    database->purgeExpired(accountId);
+
+    const qint64 budget = imageCacheBudget();
+    if (budget > 0) {
+        database->evictImages(accountId, budget);
     }
-
-    database->removeImages(images);
     database->commit();
-    database->wait();
+}
+
+// Bytes of cached images each account of this service and data type may use,
+// or 0 for no limit. Read from the "<service>/<DataType>" key, or failing that
+// the "default" key, of Sync/imagecache.ini, in MiB.
+qint64 SocialNetworkSyncAdaptor::imageCacheBudget() const
+{
+    const QString settingsFileName = QString::fromLatin1("%1/%2/imagecache.ini")
+            .arg(PRIVILEGED_DATA_DIR)
+            .arg(QString::fromLatin1(SYNC_DATABASE_DIR));
+    QSettings settingsFile(settingsFileName, QSettings::IniFormat);
+
+    const QVariant defaultBudget = settingsFile.value(QStringLiteral("default"), DEFAULT_IMAGE_CACHE_BUDGET);
+    const QString key = QStringLiteral("%1/%2").arg(m_serviceName, dataTypeName(m_dataType));
+    return settingsFile.value(key, defaultBudget).toLongLong() * 1024 * 1024;
+}
+
+void SocialNetworkSyncAdaptor::imagesPurged(int imageCount, qint64 bytesReclaimed)
+{
+    SOCIALD_LOG_INFO("Purged" << imageCount << "cached" << m_serviceName << "images, reclaimed"
+                     << bytesReclaimed << "bytes");
 }
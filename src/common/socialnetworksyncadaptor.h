@@ -24,13 +24,16 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QString>
 #include <QtCore/QJsonObject>
 #include <QtCore/QJsonArray>
+#include <QtCore/QHash>
 #include <QtCore/QMap>
 #include <QtCore/QList>
 
 #include "buteosyncfw_p.h"
+#include "synctrace.h"
 
 class QSqlDatabase;
 class QNetworkAccessManager;
@@ -38,6 +41,7 @@ class QTimer;
 class QNetworkReply;
 class SocialNetworkSyncDatabase;
 class SocialImagesDatabase;
+class TimeoutWheel;
 
 namespace Accounts {
     class Account;
@@ -106,7 +110,7 @@ protected:
     virtual void finalize(int accountId);
     QDateTime lastSyncTimestamp(const QString &serviceName, const QString &dataType,
                                 int accountId) const;
-    bool updateLastSyncTimestamp(const QString &serviceName, const QString &dataType,
+    void updateLastSyncTimestamp(const QString &serviceName, const QString &dataType,
                                  int accountId, const QDateTime &timestamp);
     QList<int> syncedAccounts(const QString &dataType);
     void setStatus(Status status);
@@ -125,6 +129,13 @@ protected:
     void removeReplyTimeout(int accountId, QNetworkReply *reply);
     void triggerReplyTimeouts();
 
+    // sync timing instrumentation, see SyncTrace.  Spans of network replies
+    // are recorded by setupReplyTimeout() and removeReplyTimeout().
+    QString traceOwner() const;
+    void startTraceSpan(SyncTrace::Phase phase, int accountId, QObject *key,
+                        const QString &detail = QString());
+    void finishTraceSpan(QObject *key, int status = 0);
+
     // Parsing methods
     static QJsonObject parseJsonObjectReplyData(const QByteArray &replyData, bool *ok);
     static QJsonArray parseJsonArrayReplyData(const QByteArray &replyData, bool *ok);
@@ -132,6 +143,7 @@ protected:
     // Cache management
     void purgeCachedImages(SocialImagesDatabase *database, int accountId);
     void purgeExpiredImages(SocialImagesDatabase *database, int accountId);
+    qint64 imageCacheBudget() const;
 
     const SocialNetworkSyncAdaptor::DataType m_dataType;
     Accounts::Manager * const m_accountManager;
@@ -139,16 +151,38 @@ protected:
     Buteo::SyncProfile *m_accountSyncProfile;
 
 protected Q_SLOTS:
-    virtual void timeoutReply();
+    virtual void timeoutReply(QObject *object);
+
+private Q_SLOTS:
+    void commitSyncTimestamps();
+    void imagesPurged(int imageCount, qint64 bytesReclaimed);
+    void traceReplyProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void traceSpanDestroyed(QObject *key);
 
 private:
+    struct PendingTraceSpan {
+        QElapsedTimer timer;
+        QString detail;
+        qint64 bytes;
+        SyncTrace::Phase phase;
+        int accountId;
+    };
+
+    bool flushSyncTimestamps();
+    void finishSyncTrace();
+
     SocialNetworkSyncDatabase *m_syncDb;
+    QTimer *m_syncDbCommitTimer;
     SocialNetworkSyncAdaptor::Status m_status;
     bool m_enabled;
     bool m_syncAborted;
     QString m_serviceName;
     QMap<int, int> m_accountSyncSemaphores;
-    QMap<int, QMap<QNetworkReply*, QTimer *> > m_networkReplyTimeouts;
+    TimeoutWheel *m_replyTimeouts;
+    QHash<QObject *, int> m_replyTimeoutAccounts;
+    QHash<QObject *, PendingTraceSpan> m_traceSpans;
+    QElapsedTimer m_syncTimer;
+    qint64 m_syncStarted;
 };
 
 #endif // SOCIALNETWORKSYNCADAPTOR_H
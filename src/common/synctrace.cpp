@@ -0,0 +1,250 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#include "synctrace.h"
+#include "synctrace_p.h"
+#include "trace.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+#include <QtDBus/QDBusConnection>
+
+#include <algorithm>
+
+namespace {
+    const int DEFAULT_SYNC_TRACE_SIZE = 512;
+
+    int traceBufferSize()
+    {
+        static const int size = qEnvironmentVariableIsSet("SOCIALD_SYNC_TRACE_SIZE")
+                ? qMax(0, qgetenv("SOCIALD_SYNC_TRACE_SIZE").toInt())
+                : DEFAULT_SYNC_TRACE_SIZE;
+        return size;
+    }
+
+    struct TraceBuffer
+    {
+        TraceBuffer() : next(0) {}
+
+        QMutex mutex;
+        QVector<SyncTrace::Span> spans;
+        int next;   // where the next span goes once the buffer is full
+    };
+
+    struct TraceContext
+    {
+        TraceContext() : accountId(0) {}
+
+        QString owner;
+        int accountId;
+    };
+
+    bool startedBefore(const SyncTrace::Span &lhs, const SyncTrace::Span &rhs)
+    {
+        return lhs.started < rhs.started;
+    }
+
+    Q_GLOBAL_STATIC(TraceBuffer, traceBuffer)
+    Q_GLOBAL_STATIC(QThreadStorage<TraceContext>, traceContext)
+}
+
+bool SyncTrace::isEnabled()
+{
+    return traceBufferSize() > 0;
+}
+
+void SyncTrace::record(Phase phase, const QString &owner, int accountId,
+                       const QElapsedTimer &timer, qint64 bytes,
+                       int status, const QString &detail)
+{
+    if (!isEnabled() || !timer.isValid()) {
+        return;
+    }
+
+    Span span;
+    span.phase = phase;
+    span.owner = owner;
+    span.accountId = accountId;
+    span.duration = timer.elapsed();
+    span.started = QDateTime::currentMSecsSinceEpoch() - span.duration;
+    span.bytes = bytes;
+    span.status = status;
+    span.detail = detail;
+
+    TraceBuffer *buffer = traceBuffer();
+    QMutexLocker locker(&buffer->mutex);
+    if (buffer->spans.size() < traceBufferSize()) {
+        buffer->spans.append(span);
+    } else {
+        buffer->spans[buffer->next] = span;
+        buffer->next = (buffer->next + 1) % buffer->spans.size();
+    }
+}
+
+QList<SyncTrace::Span> SyncTrace::spans(const QString &owner, qint64 since)
+{
+    QList<Span> result;
+    TraceBuffer *buffer = traceBuffer();
+    QMutexLocker locker(&buffer->mutex);
+    // oldest first; spans are recorded when they end, so sort by start
+    for (int i = 0; i < buffer->spans.size(); ++i) {
+        const Span &span = buffer->spans.at((buffer->next + i) % buffer->spans.size());
+        if ((owner.isEmpty() || span.owner == owner) && span.started >= since) {
+            result.append(span);
+        }
+    }
+    locker.unlock();
+
+    std::stable_sort(result.begin(), result.end(), startedBefore);
+    return result;
+}
+
+// One line per span:
+// <start> <owner> account <id> <phase> <duration> ms [<bytes> bytes] [status <status>] [<detail>]
+QString SyncTrace::format(const QList<Span> &spans)
+{
+    QString text;
+    Q_FOREACH (const Span &span, spans) {
+        text += QStringLiteral("%1 %2 account %3 %4 %5 ms")
+                .arg(QDateTime::fromMSecsSinceEpoch(span.started).toString(QStringLiteral("yyyy-MM-ddTHH:mm:ss.zzz")))
+                .arg(span.owner.isEmpty() ? QStringLiteral("-") : span.owner)
+                .arg(span.accountId)
+                .arg(phaseName(span.phase))
+                .arg(span.duration);
+        if (span.bytes >= 0) {
+            text += QStringLiteral(" %1 bytes").arg(span.bytes);
+        }
+        if (span.status != 0) {
+            text += QStringLiteral(" status %1").arg(span.status);
+        }
+        if (!span.detail.isEmpty()) {
+            text += QLatin1Char(' ') + span.detail;
+        }
+        text += QLatin1Char('\n');
+    }
+    return text;
+}
+
+bool SyncTrace::appendToFile(const QString &fileName, const QList<Span> &spans)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        SOCIALD_LOG_ERROR("unable to open sync trace file" << fileName << ":" << file.errorString());
+        return false;
+    }
+    return file.write(format(spans).toUtf8()) != -1;
+}
+
+QString SyncTrace::phaseName(Phase phase)
+{
+    switch (phase) {
+        case SyncTrace::Sync:     return QStringLiteral("sync");
+        case SyncTrace::SignOn:   return QStringLiteral("signon");
+        case SyncTrace::Request:  return QStringLiteral("request");
+        case SyncTrace::Parse:    return QStringLiteral("parse");
+        case SyncTrace::Storage:  return QStringLiteral("storage");
+        case SyncTrace::Finalize: return QStringLiteral("finalize");
+        default: break;
+    }
+
+    return QString();
+}
+
+// Called from the adaptors' constructors; only the first call in the
+// application's thread has any effect. The object is only exported with
+// SOCIALD_SYNC_TRACE_DBUS set, as any session bus client may read it.
+void SyncTrace::registerDBusObject()
+{
+    static bool registered = false;
+    QCoreApplication *app = QCoreApplication::instance();
+    if (registered || !isEnabled() || qgetenv("SOCIALD_SYNC_TRACE_DBUS").isEmpty()
+            || !app || app->thread() != QThread::currentThread()) {
+        return;
+    }
+    registered = true;
+
+    SyncTraceDBusObject *object = new SyncTraceDBusObject(app);
+    if (!QDBusConnection::sessionBus().registerObject(QStringLiteral("/sociald/synctrace"), object,
+                                                      QDBusConnection::ExportScriptableSlots)) {
+        SOCIALD_LOG_DEBUG("unable to register sync trace object on the session bus");
+        delete object;
+    }
+}
+
+void SyncTrace::setCurrentContext(const QString &owner, int accountId)
+{
+    TraceContext &context = traceContext()->localData();
+    context.owner = owner;
+    context.accountId = accountId;
+}
+
+QString SyncTrace::currentOwner()
+{
+    return traceContext()->hasLocalData() ? traceContext()->localData().owner : QString();
+}
+
+int SyncTrace::currentAccountId()
+{
+    return traceContext()->hasLocalData() ? traceContext()->localData().accountId : 0;
+}
+
+SyncTraceScope::SyncTraceScope(SyncTrace::Phase phase, const QString &owner, int accountId,
+                               const QString &detail)
+    : m_owner(owner)
+    , m_detail(detail)
+    , m_bytes(-1)
+    , m_phase(phase)
+    , m_accountId(accountId)
+    , m_status(0)
+{
+    if (SyncTrace::isEnabled()) {
+        m_timer.start();
+    }
+}
+
+SyncTraceScope::~SyncTraceScope()
+{
+    SyncTrace::record(m_phase, m_owner, m_accountId, m_timer, m_bytes, m_status, m_detail);
+}
+
+void SyncTraceScope::setBytes(qint64 bytes)
+{
+    m_bytes = bytes;
+}
+
+void SyncTraceScope::setStatus(int status)
+{
+    m_status = status;
+}
+
+SyncTraceDBusObject::SyncTraceDBusObject(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QString SyncTraceDBusObject::Dump(const QString &owner)
+{
+    return SyncTrace::format(SyncTrace::spans(owner));
+}
@@ -0,0 +1,101 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#ifndef SYNCTRACE_H
+#define SYNCTRACE_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+/*
+    Records how long the phases of a sync take into a ring buffer shared
+    by all adaptors of the process. The buffer holds SOCIALD_SYNC_TRACE_SIZE
+    spans (512 by default, 0 disables tracing). With SOCIALD_SYNC_TRACE_DBUS
+    set it can be read over D-Bus from the /sociald/synctrace object, and
+    with SOCIALD_SYNC_TRACE_FILE set it is appended to that file whenever
+    a sync finishes.
+*/
+class SyncTrace
+{
+public:
+    enum Phase {
+        Sync = 0,   // a whole sync, from Busy to Inactive
+        SignOn,
+        Request,    // one network request
+        Parse,      // decoding a reply
+        Storage,    // applying data to local storage
+        Finalize
+    };
+
+    struct Span {
+        Phase phase;
+        QString owner;      // "<service>.<DataType>"
+        int accountId;
+        qint64 started;     // msecs since the epoch
+        qint64 duration;    // msecs
+        qint64 bytes;       // -1 if not known
+        int status;         // HTTP status for requests; 0 on success or -1 on failure otherwise
+        QString detail;
+    };
+
+    static bool isEnabled();
+    static void record(Phase phase, const QString &owner, int accountId,
+                       const QElapsedTimer &timer, qint64 bytes = -1,
+                       int status = 0, const QString &detail = QString());
+
+    // Spans of the given owner (or of all owners) which started at or after since
+    static QList<Span> spans(const QString &owner = QString(), qint64 since = 0);
+    static QString format(const QList<Span> &spans);
+    static bool appendToFile(const QString &fileName, const QList<Span> &spans);
+    static QString phaseName(Phase phase);
+
+    static void registerDBusObject();
+
+    // The adaptor and account whose reply was handled last on this thread,
+    // which static helpers such as the JSON parsers attribute their spans to
+    static void setCurrentContext(const QString &owner, int accountId);
+    static QString currentOwner();
+    static int currentAccountId();
+};
+
+// Records a span covering its own lifetime
+class SyncTraceScope
+{
+public:
+    SyncTraceScope(SyncTrace::Phase phase, const QString &owner, int accountId,
+                   const QString &detail = QString());
+    ~SyncTraceScope();
+
+    void setBytes(qint64 bytes);
+    void setStatus(int status);
+
+private:
+    Q_DISABLE_COPY(SyncTraceScope)
+    QElapsedTimer m_timer;
+    QString m_owner;
+    QString m_detail;
+    qint64 m_bytes;
+    SyncTrace::Phase m_phase;
+    int m_accountId;
+    int m_status;
+};
+
+#endif // SYNCTRACE_H
@@ -0,0 +1,40 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#ifndef SYNCTRACE_P_H
+#define SYNCTRACE_P_H
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+// Exposes the process' sync trace buffer on the session bus
+class SyncTraceDBusObject : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.sailfishos.sociald.SyncTrace")
+
+public:
+    explicit SyncTraceDBusObject(QObject *parent = 0);
+
+public Q_SLOTS:
+    Q_SCRIPTABLE QString Dump(const QString &owner);
+};
+
+#endif // SYNCTRACE_P_H
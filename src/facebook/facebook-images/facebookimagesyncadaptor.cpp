@@ -20,6 +20,7 @@
  ****************************************************************************/
 
 #include "facebookimagesyncadaptor.h"
+#include "jsonstreamreader.h"
 #include "trace.h"
 
 #include <QtCore/QPair>
@@ -171,6 +172,9 @@ void FacebookImageSyncAdaptor::requestData(int accountId,
         connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(errorHandler(QNetworkReply::NetworkError)));
         connect(reply, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(sslErrorsHandler(QList<QSslError>)));
         if (fbAlbumId.isEmpty()) {
+            // album lists can be large; parse each album as it arrives
+            new JsonStreamReader(QStringLiteral("data"), reply);
+            connect(reply, SIGNAL(readyRead()), this, SLOT(albumsDataAvailable()));
             connect(reply, SIGNAL(finished()), this, SLOT(albumsFinishedHandler()));
         } else {
             connect(reply, SIGNAL(finished()), this, SLOT(imagesFinishedHandler()));
@@ -185,22 +189,33 @@ void FacebookImageSyncAdaptor::requestData(int accountId,
     }
 }
 
+void FacebookImageSyncAdaptor::albumsDataAvailable()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    JsonStreamReader *reader = reply->findChild<JsonStreamReader*>();
+    if (reply->property("isError").toBool()) {
+        return; // albumsFinishedHandler() reports the error
+    }
+    // Albums are only parsed here. They are applied once the whole reply
+    // is known to be good, so a truncated or failed page changes nothing.
+    reader->addData(reply->readAll());
+}
+
 void FacebookImageSyncAdaptor::albumsFinishedHandler()
 {
     QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    JsonStreamReader *reader = reply->findChild<JsonStreamReader*>();
     bool isError = reply->property("isError").toBool();
     int accountId = reply->property("accountId").toInt();
     QString accessToken = reply->property("accessToken").toString();
-    QString fbUserId = reply->property("fbUserId").toString();
-    QString fbAlbumId = reply->property("fbAlbumId").toString();
     QString continuationUrl = reply->property("continuationUrl").toString();
-    QByteArray replyData = reply->readAll();
+    reader->addData(reply->readAll());
     disconnect(reply);
     reply->deleteLater();
     removeReplyTimeout(accountId, reply);
 
-    bool ok = false;
-    QJsonObject parsed = parseJsonObjectReplyData(replyData, &ok);
+    bool ok = reader->finish();
+    QJsonObject parsed = reader->remainder();
     if (isError || !ok || !parsed.contains(QLatin1String("data"))) {
         SOCIALD_LOG_ERROR("unable to read albums response for Facebook account with id" << accountId);
         clearRemovalDetectionLists(); // don't perform server-side removal detection during this sync run.
@@ -208,16 +223,38 @@ void FacebookImageSyncAdaptor::albumsFinishedHandler()
         return;
     }
 
-    QJsonArray data = parsed.value(QLatin1String("data")).toArray();
-    if (data.size() == 0) {
+    QString fbUserId = processAlbums(reply, reader);
+    if (reader->elementCount() == 0) {
         SOCIALD_LOG_DEBUG("Facebook account with id" << accountId << "has no albums");
         decrementSemaphore(accountId);
         return;
     }
 
+    // Perform a continuation request if required.
+    QJsonObject paging = parsed.value(QLatin1String("paging")).toObject();
+    QString nextUrl = paging.value(QLatin1String("next")).toString();
+    if (!nextUrl.isEmpty() && nextUrl != continuationUrl) {
+        // note: we check equality because fb can return spurious paging data...
+        SOCIALD_LOG_DEBUG("performing continuation request for more albums for Facebook account with id" << accountId << ":" << nextUrl);
+        requestData(accountId, accessToken, nextUrl, fbUserId, QString());
+    }
+
+    // Finally, reduce our semaphore.
+    decrementSemaphore(accountId);
+}
+
+// Returns the user id of the albums, for the continuation request.
+QString FacebookImageSyncAdaptor::processAlbums(QNetworkReply *reply, JsonStreamReader *reader)
+{
+    int accountId = reply->property("accountId").toInt();
+    QString accessToken = reply->property("accessToken").toString();
+    QString fbUserId = reply->property("fbUserId").toString();
+    QString fbAlbumId = reply->property("fbAlbumId").toString();
+
     // read the albums information
-    for (int i = 0; i < data.size(); ++i) {
-        QJsonObject albumObject = data.at(i).toObject();
+    QJsonValue album;
+    while (reader->readElement(&album)) {
+        QJsonObject albumObject = album.toObject();
         if (albumObject.isEmpty()) {
             continue;
         }
@@ -266,17 +303,7 @@ void FacebookImageSyncAdaptor::albumsFinishedHandler()
         requestData(accountId, accessToken, QString(), fbUserId, fbAlbumId);
     }
 
-    // Perform a continuation request if required.
-    QJsonObject paging = parsed.value(QLatin1String("paging")).toObject();
-    QString nextUrl = paging.value(QLatin1String("next")).toString();
-    if (!nextUrl.isEmpty() && nextUrl != continuationUrl) {
-        // note: we check equality because fb can return spurious paging data...
-        SOCIALD_LOG_DEBUG("performing continuation request for more albums for Facebook account with id" << accountId << ":" << nextUrl);
-        requestData(accountId, accessToken, nextUrl, fbUserId, QString());
-    }
-
-    // Finally, reduce our semaphore.
-    decrementSemaphore(accountId);
+    return fbUserId;
 }
 
 void FacebookImageSyncAdaptor::imagesFinishedHandler()
@@ -36,6 +36,8 @@
 
 #include <socialcache/facebookimagesdatabase.h>
 
+class JsonStreamReader;
+
 class FacebookImageSyncAdaptor
         : public FacebookDataTypeSyncAdaptor
 {
@@ -58,9 +60,11 @@ private:
                      const QString &fbUserId, const QString &fbAlbumId);
     bool haveAlreadyCachedImage(const QString &fbImageId, const QString &imageUrl);
     void possiblyAddNewUser(const QString &fbUserId, int accountId, const QString &accessToken);
+    QString processAlbums(QNetworkReply *reply, JsonStreamReader *reader);
 
 
 private Q_SLOTS:
+    void albumsDataAvailable();
     void albumsFinishedHandler();
     void imagesFinishedHandler();
     void userFinishedHandler();
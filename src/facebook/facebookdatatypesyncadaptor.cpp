@@ -211,6 +211,7 @@ void FacebookDataTypeSyncAdaptor::signIn(Accounts::Account *account)
 
     session->setProperty("account", QVariant::fromValue<Accounts::Account*>(account));
     session->setProperty("identity", QVariant::fromValue<SignOn::Identity*>(identity));
+    startTraceSpan(SyncTrace::SignOn, accountId, session);
     session->process(SignOn::SessionData(signonSessionData), mechanism);
 }
 
@@ -229,6 +230,7 @@ void FacebookDataTypeSyncAdaptor::signOnError(const SignOn::Error &error)
         setCredentialsNeedUpdate(account);
     }
 
+    finishTraceSpan(session, -1);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
@@ -259,6 +261,7 @@ void FacebookDataTypeSyncAdaptor::signOnResponse(const SignOn::SessionData &resp
 
     m_graphAPI = account->value(QStringLiteral("graph_api/Host")).toString();
 
+    finishTraceSpan(session);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
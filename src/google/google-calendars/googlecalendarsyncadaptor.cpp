@@ -1034,7 +1034,11 @@ void GoogleCalendarSyncAdaptor::finalCleanup()
             }
         } else {
             // sync succeeded.  apply the changes to the database.
-            applyRemoteChangesLocally();
+            {
+                SyncTraceScope span(SyncTrace::Storage, traceOwner(), m_accountId,
+                                    QStringLiteral("applyRemoteChangesLocally"));
+                applyRemoteChangesLocally();
+            }
             if (!m_syncSucceeded) {
                 SOCIALD_LOG_INFO("Error occurred while applying remote changes locally");
             } else {
@@ -1074,6 +1078,7 @@ void GoogleCalendarSyncAdaptor::finalCleanup()
 
     SOCIALD_LOG_DEBUG("Saving:" << m_storageNeedsSave);
     if (m_storageNeedsSave) {
+        SyncTraceScope span(SyncTrace::Storage, traceOwner(), m_accountId, QStringLiteral("save"));
         m_storage->save(mKCal::ExtendedStorage::PurgeDeleted);
     }
     m_storageNeedsSave = false;
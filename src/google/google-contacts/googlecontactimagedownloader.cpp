@@ -47,6 +47,7 @@ QNetworkReply * GoogleContactImageDownloader::createReply(const QString &url,
     QNetworkRequest request(url);
     request.setRawHeader(QString(QLatin1String("Authorization")).toUtf8(),
                          QString(QLatin1String("Bearer ") + accessToken).toUtf8());
+    setConditionalHeaders(&request, metadata);
     return d->networkAccessManager->get(request);
 }
 
@@ -226,6 +226,7 @@ GoogleTwoWayContactSyncAdaptor::GoogleTwoWayContactSyncAdaptor(QObject *parent)
 {
     connect(m_workerObject, &AbstractImageDownloader::imageDownloaded,
             this, &GoogleTwoWayContactSyncAdaptor::imageDownloaded);
+    m_workerObject->startWorkerThread();
 
     // can sync, enabled
     setInitialActive(true);
@@ -233,6 +234,7 @@ GoogleTwoWayContactSyncAdaptor::GoogleTwoWayContactSyncAdaptor(QObject *parent)
 
 GoogleTwoWayContactSyncAdaptor::~GoogleTwoWayContactSyncAdaptor()
 {
+    m_workerObject->stopWorkerThread();
     delete m_workerObject;
 }
 
@@ -263,6 +263,7 @@ void GoogleDataTypeSyncAdaptor::signIn(Accounts::Account *account)
 
     session->setProperty("account", QVariant::fromValue<Accounts::Account*>(account));
     session->setProperty("identity", QVariant::fromValue<SignOn::Identity*>(identity));
+    startTraceSpan(SyncTrace::SignOn, accountId, session);
     session->process(SignOn::SessionData(signonSessionData), mechanism);
 }
 
@@ -281,6 +282,7 @@ void GoogleDataTypeSyncAdaptor::signOnError(const SignOn::Error &error)
         setCredentialsNeedUpdate(account);
     }
 
+    finishTraceSpan(session, -1);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
@@ -309,6 +311,7 @@ void GoogleDataTypeSyncAdaptor::signOnResponse(const SignOn::SessionData &respon
         SOCIALD_LOG_INFO("signon response for account with id" << accountId << "contained no access token");
     }
 
+    finishTraceSpan(session);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
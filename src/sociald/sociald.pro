@@ -2,19 +2,30 @@ TARGET = sociald-client
 
 include($$PWD/../common.pri)
 
-HEADERS += socialdplugin.h
-SOURCES += socialdplugin.cpp
+HEADERS += \
+    socialdplugin.h \
+    socialdsyncscheduler.h
+SOURCES += \
+    socialdplugin.cpp \
+    socialdsyncscheduler.cpp
+
+# The shipped configuration is built in as the fallback for a missing one
+RESOURCES += sociald.qrc
 
 sociald_sync_profile.path = /etc/buteo/profiles/sync
 sociald_sync_profile.files = $$PWD/sociald.All.xml
 sociald_client_plugin_xml.path = /etc/buteo/profiles/client
 sociald_client_plugin_xml.files = $$PWD/sociald.xml
+sociald_scheduler_config.path = /etc/buteo
+sociald_scheduler_config.files = $$PWD/sociald.All.ini
 
 OTHER_FILES += \
     sociald_sync_profile.files \
-    sociald_client_plugin_xml.files
+    sociald_client_plugin_xml.files \
+    sociald_scheduler_config.files
 
 INSTALLS += \
     target \
     sociald_sync_profile \
-    sociald_client_plugin_xml
+    sociald_client_plugin_xml \
+    sociald_scheduler_config
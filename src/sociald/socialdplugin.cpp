@@ -19,24 +19,29 @@
  ****************************************************************************/
 
 #include "socialdplugin.h"
+#include "socialdsyncscheduler.h"
 #include "trace.h"
 
 #include <QCoreApplication>
 #include <QTranslator>
 #include <QStringList>
-#include <QDBusConnection>
-#include <QDBusMessage>
-#include <QDBusPendingCall>
 
 #include <PluginCbInterface.h>
 #include <LogMacros.h>
 
+namespace {
+    const QString SCHEDULER_CONFIGURATION = QStringLiteral("/etc/buteo/sociald.All.ini");
 
+    // Built in from sociald.All.ini, used when the installed one is
+    // missing or lists no jobs
+    const QString DEFAULT_SCHEDULER_CONFIGURATION = QStringLiteral(":/sociald/sociald.All.ini");
+}
 
 SocialdPlugin::SocialdPlugin(const QString& pluginName,
                              const Buteo::SyncProfile& profile,
                              Buteo::PluginCbInterface *callbackInterface)
     : ClientPlugin(pluginName, profile, callbackInterface)
+    , m_scheduler(0)
 {
 }
 
@@ -73,45 +78,44 @@ bool SocialdPlugin::uninit()
 
 bool SocialdPlugin::startSync()
 {
-    QStringList startSyncParams;
+    delete m_scheduler;
+    m_scheduler = new SocialdSyncScheduler(this);
+    connect(m_scheduler, SIGNAL(finished()), this, SLOT(schedulerFinished()));
+
     if (!m_dataType.isEmpty() && !m_serviceName.isEmpty()) {
         // trigger sync of specific data type with all accounts.
-        startSyncParams.append(QStringLiteral("%1.%2").arg(m_serviceName, m_dataType));
-    } else {
-        // trigger sync of all known data types with all accounts.
-        startSyncParams << "google.Calendars";
-        startSyncParams << "google.Contacts";
-        startSyncParams << "facebook.Calendars";
-        startSyncParams << "facebook.Contacts";
-        startSyncParams << "facebook.Images";
-        startSyncParams << "facebook.Notifications";
-        //startSyncParams << "facebook.Posts";
-        startSyncParams << "twitter.Notifications";
-        startSyncParams << "twitter.Posts";
-        startSyncParams << "vk.Posts";
-        startSyncParams << "vk.Notifications";
-        startSyncParams << "vk.Calendars";
-        startSyncParams << "vk.Contacts";
-        startSyncParams << "vk.Images";
+        m_scheduler->addJob(QStringLiteral("%1.%2").arg(m_serviceName, m_dataType));
+    } else if (!m_scheduler->loadConfiguration(SCHEDULER_CONFIGURATION)) {
+        SOCIALD_LOG_ERROR("no sync jobs configured in" << SCHEDULER_CONFIGURATION
+                          << ", syncing the default data types");
+        m_scheduler->loadConfiguration(DEFAULT_SCHEDULER_CONFIGURATION);
     }
 
-    foreach (const QString &param, startSyncParams) {
-        QDBusMessage message = QDBusMessage::createMethodCall(
-                "com.meego.msyncd", "/synchronizer", "com.meego.msyncd", "startSync");
-        message.setArguments(QVariantList() << param);
-        QDBusConnection::sessionBus().asyncCall(message);
-    }
+    // trigger sync of the data types, a few at a time.  The result is
+    // reported once they have all finished.
+    m_scheduler->start();
+    return true;
+}
 
-    // always "succeed" even though the actual sync may fail.
+void SocialdPlugin::schedulerFinished()
+{
+    // always "succeed" even though the actual syncs may fail.
     updateResults(Buteo::SyncResults(QDateTime::currentDateTime(),
                                      Buteo::SyncResults::SYNC_RESULT_SUCCESS,
                                      Buteo::SyncResults::NO_ERROR));
-
-    return true;
+    emit success(getProfileName(), QString("%1 update succeeded").arg(getProfileName()));
 }
 
 void SocialdPlugin::abortSync(Sync::SyncStatus)
 {
+    if (m_scheduler) {
+        m_scheduler->abort();
+        updateResults(Buteo::SyncResults(QDateTime::currentDateTime(),
+                                         Buteo::SyncResults::SYNC_RESULT_FAILED,
+                                         Buteo::SyncResults::ABORTED));
+        emit error(getProfileName(), QString("%1 update aborted").arg(getProfileName()),
+                   Buteo::SyncResults::ABORTED);
+    }
 }
 
 bool SocialdPlugin::cleanUp()
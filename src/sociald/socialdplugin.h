@@ -26,6 +26,8 @@
 
 #include "buteosyncfw_p.h"
 
+class SocialdSyncScheduler;
+
 /*
    This plugin implementation provides a simple way
    to trigger syncs of all datatypes for all accounts,
@@ -45,6 +47,9 @@
        sociald.twitter.Notifications.xml
        sociald.twitter.Posts.xml
 
+   The data types synced by sociald.All, their priorities and how many
+   of them run at once are configured in /etc/buteo/sociald.All.ini.
+
    Note that it does not extend SocialdButeoPlugin
    (from common.pri) as it uses a different mechanism.
 */
@@ -68,9 +73,13 @@ public:
 public slots:
     void connectivityStateChanged(Sync::ConnectivityType type, bool state);
 
+private slots:
+    void schedulerFinished();
+
 private:
     void updateResults(const Buteo::SyncResults &results);
     Buteo::SyncResults m_syncResults;
+    SocialdSyncScheduler *m_scheduler;
     QString m_dataType;
     QString m_serviceName;
 };
@@ -0,0 +1,280 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#include "socialdsyncscheduler.h"
+#include "buteosyncfw_p.h"
+#include "trace.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
+#include <QtDBus/QDBusPendingReply>
+
+namespace {
+    const int DEFAULT_MAX_CONCURRENT_JOBS = 3;
+    const int DEFAULT_JOB_TIMEOUT = 900;   // seconds
+
+    // How long a job whose profiles have all finished is kept, in case
+    // msyncd has yet to report per-account profiles which it started
+    const int JOB_SETTLE_TIME = 2000;
+    const int CHECK_INTERVAL = 1000;
+
+    QDBusMessage msyncdMethodCall(const QString &method, const QString &profileName)
+    {
+        QDBusMessage message = QDBusMessage::createMethodCall(
+                "com.meego.msyncd", "/synchronizer", "com.meego.msyncd", method);
+        message.setArguments(QVariantList() << profileName);
+        return message;
+    }
+
+    bool isSyncRunning(int status)
+    {
+        return status == Sync::SYNC_QUEUED
+            || status == Sync::SYNC_STARTED
+            || status == Sync::SYNC_PROGRESS
+            || status == Sync::SYNC_STOPPING;
+    }
+}
+
+SocialdSyncScheduler::SocialdSyncScheduler(QObject *parent)
+    : QObject(parent)
+    , m_maxConcurrentJobs(DEFAULT_MAX_CONCURRENT_JOBS)
+    , m_jobTimeout(DEFAULT_JOB_TIMEOUT)
+    , m_nextBatch(0)
+    , m_batchBySignOn(true)
+    , m_started(false)
+{
+    m_checkTimer.setInterval(CHECK_INTERVAL);
+    connect(&m_checkTimer, SIGNAL(timeout()), this, SLOT(checkRunningJobs()));
+}
+
+SocialdSyncScheduler::~SocialdSyncScheduler()
+{
+    if (m_started) {
+        QDBusConnection::sessionBus().disconnect(
+                "com.meego.msyncd", "/synchronizer", "com.meego.msyncd", "syncStatus",
+                this, SLOT(syncStatus(QString,int,QString,int)));
+    }
+}
+
+bool SocialdSyncScheduler::loadConfiguration(const QString &fileName)
+{
+    if (!QFile::exists(fileName)) {
+        return false;
+    }
+
+    QSettings settings(fileName, QSettings::IniFormat);
+    m_maxConcurrentJobs = qMax(1, settings.value(QStringLiteral("maxConcurrentJobs"),
+                                                 DEFAULT_MAX_CONCURRENT_JOBS).toInt());
+    m_jobTimeout = settings.value(QStringLiteral("jobTimeout"), DEFAULT_JOB_TIMEOUT).toInt();
+    m_batchBySignOn = settings.value(QStringLiteral("batchBySignOn"), true).toBool();
+
+    // QSettings returns keys sorted, so the jobs are read from the file
+    // itself, keeping its order for jobs of the same priority
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+
+    bool inJobs = false;
+    while (!file.atEnd()) {
+        const QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith(QLatin1Char(';')) || line.startsWith(QLatin1Char('#'))) {
+            continue;
+        } else if (line.startsWith(QLatin1Char('['))) {
+            inJobs = line == QLatin1String("[Jobs]");
+            continue;
+        }
+
+        const int separator = line.indexOf(QLatin1Char('='));
+        if (inJobs && separator > 0) {
+            addJob(line.left(separator).trimmed(), line.mid(separator + 1).trimmed().toInt());
+        }
+    }
+
+    return !m_queue.isEmpty();
+}
+
+void SocialdSyncScheduler::addJob(const QString &profileName, int priority)
+{
+    Job job;
+    job.profileName = profileName;
+    job.serviceName = profileName.section(QLatin1Char('.'), 0, 0);
+    job.priority = priority;
+    job.batch = -1;
+    job.profileDone = false;
+
+    // keep the queue sorted by priority, in the order jobs were added
+    int index = m_queue.size();
+    while (index > 0 && m_queue.at(index - 1).priority > priority) {
+        --index;
+    }
+    m_queue.insert(index, job);
+}
+
+void SocialdSyncScheduler::start()
+{
+    if (!m_started) {
+        m_started = true;
+        QDBusConnection::sessionBus().connect(
+                "com.meego.msyncd", "/synchronizer", "com.meego.msyncd", "syncStatus",
+                this, SLOT(syncStatus(QString,int,QString,int)));
+    }
+
+    SOCIALD_LOG_INFO("scheduling" << m_queue.size() << "sync jobs," << m_maxConcurrentJobs << "at a time");
+    m_checkTimer.start();
+    checkRunningJobs();
+}
+
+void SocialdSyncScheduler::abort()
+{
+    m_queue.clear();
+    m_checkTimer.stop();
+
+    Q_FOREACH (const Job &job, m_running) {
+        Q_FOREACH (const QString &profileId, job.activeProfiles) {
+            QDBusConnection::sessionBus().asyncCall(msyncdMethodCall(QStringLiteral("abortSync"), profileId));
+        }
+    }
+    m_running.clear();
+}
+
+/*
+    Starts the highest priority queued job and, with sign-on batching, the
+    queued jobs of its service at the same or the next priority, as long as
+    there are free slots.  Each job takes a slot of its own.
+*/
+void SocialdSyncScheduler::startNextBatch(int freeSlots)
+{
+    const int batch = m_nextBatch++;
+    const QString serviceName = m_queue.first().serviceName;
+    int maxPriority = m_queue.first().priority;
+    Q_FOREACH (const Job &job, m_queue) {
+        if (job.priority > maxPriority) {
+            maxPriority = job.priority;
+            break;
+        }
+    }
+
+    for (int i = 0; i < m_queue.size() && freeSlots > 0; ) {
+        if (i == 0 || (m_batchBySignOn && m_queue.at(i).serviceName == serviceName
+                       && m_queue.at(i).priority <= maxPriority)) {
+            Job job = m_queue.takeAt(i);
+            job.batch = batch;
+            job.runTime.start();
+            job.idleTime.start();
+            m_running.append(job);
+            --freeSlots;
+
+            SOCIALD_LOG_DEBUG("starting sync job" << job.profileName << "in batch" << batch);
+            QDBusPendingCall call = QDBusConnection::sessionBus().asyncCall(
+                    msyncdMethodCall(QStringLiteral("startSync"), job.profileName));
+            QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+            watcher->setProperty("profileName", job.profileName);
+            connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                    this, SLOT(startSyncFinished(QDBusPendingCallWatcher*)));
+        } else {
+            ++i;
+        }
+    }
+}
+
+void SocialdSyncScheduler::startSyncFinished(QDBusPendingCallWatcher *watcher)
+{
+    QDBusPendingReply<bool> reply = *watcher;
+    const QString profileName = watcher->property("profileName").toString();
+    watcher->deleteLater();
+
+    if (reply.isError() || !reply.value()) {
+        // e.g. the plugin of that service isn't installed
+        SOCIALD_LOG_DEBUG("msyncd did not start sync job" << profileName << ":" << reply.error().message());
+        const int index = jobForProfile(profileName);
+        if (index >= 0) {
+            finishJob(index);
+            checkRunningJobs();
+        }
+    }
+}
+
+void SocialdSyncScheduler::syncStatus(const QString &profileId, int status, const QString &message, int statusDetails)
+{
+    Q_UNUSED(message)
+    Q_UNUSED(statusDetails)
+
+    const int index = jobForProfile(profileId);
+    if (index < 0) {
+        return;
+    }
+
+    Job &job = m_running[index];
+    job.idleTime.restart();
+    if (isSyncRunning(status)) {
+        job.activeProfiles.insert(profileId);
+    } else {
+        job.activeProfiles.remove(profileId);
+        if (profileId == job.profileName) {
+            job.profileDone = true;
+        }
+    }
+}
+
+void SocialdSyncScheduler::checkRunningJobs()
+{
+    for (int i = m_running.size() - 1; i >= 0; --i) {
+        const Job &job = m_running.at(i);
+        if (job.profileDone && job.activeProfiles.isEmpty() && job.idleTime.elapsed() >= JOB_SETTLE_TIME) {
+            finishJob(i);
+        } else if (m_jobTimeout > 0 && job.runTime.elapsed() >= m_jobTimeout * 1000LL) {
+            SOCIALD_LOG_INFO("sync job" << job.profileName << "still running after" << m_jobTimeout
+                             << "seconds; no longer waiting for it");
+            finishJob(i);
+        }
+    }
+
+    while (!m_queue.isEmpty() && m_running.size() < m_maxConcurrentJobs) {
+        startNextBatch(m_maxConcurrentJobs - m_running.size());
+    }
+
+    if (m_running.isEmpty() && m_queue.isEmpty() && m_checkTimer.isActive()) {
+        m_checkTimer.stop();
+        emit finished();
+    }
+}
+
+void SocialdSyncScheduler::finishJob(int index)
+{
+    const Job job = m_running.takeAt(index);
+    SOCIALD_LOG_DEBUG("sync job" << job.profileName << "finished after" << job.runTime.elapsed() << "ms");
+}
+
+int SocialdSyncScheduler::jobForProfile(const QString &profileId) const
+{
+    for (int i = 0; i < m_running.size(); ++i) {
+        const QString &profileName = m_running.at(i).profileName;
+        if (profileId == profileName
+                || (profileId.startsWith(profileName) && profileId.at(profileName.size()) == QLatin1Char('-'))) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,97 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#ifndef SOCIALDSYNCSCHEDULER_H
+#define SOCIALDSYNCSCHEDULER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+
+class QDBusPendingCallWatcher;
+
+/*
+   Triggers the sync of a list of "<service>.<DataType>" profiles through
+   msyncd, a few at a time instead of all at once.
+
+   Jobs with a lower priority value start first, and jobs of the same
+   priority in the order they were added.  With sign-on batching,
+   the queued data types of a service at the same or the next priority are
+   started together with the first one while slots are free, so they sign
+   on to the account at about the same time.  Each counts as a job against
+   the concurrency limit.
+
+   A job has finished once msyncd has reported the end of its profile and
+   of the per-account profiles ("<service>.<DataType>-<accountId>") which
+   it started.
+*/
+class SocialdSyncScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SocialdSyncScheduler(QObject *parent = 0);
+    ~SocialdSyncScheduler();
+
+    // Reads the limits and the jobs from the given ini file, see sociald.All.ini
+    bool loadConfiguration(const QString &fileName);
+    void addJob(const QString &profileName, int priority = 0);
+
+    void start();
+    void abort();
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void syncStatus(const QString &profileId, int status, const QString &message, int statusDetails);
+    void startSyncFinished(QDBusPendingCallWatcher *watcher);
+    void checkRunningJobs();
+
+private:
+    struct Job {
+        QString profileName;
+        QString serviceName;
+        int priority;
+        int batch;
+        bool profileDone;
+        QSet<QString> activeProfiles;
+        QElapsedTimer runTime;
+        QElapsedTimer idleTime;
+    };
+
+    void startNextBatch(int freeSlots);
+    void finishJob(int index);
+    int jobForProfile(const QString &profileId) const;
+
+    QList<Job> m_queue;
+    QList<Job> m_running;
+    QTimer m_checkTimer;
+    int m_maxConcurrentJobs;
+    int m_jobTimeout;
+    int m_nextBatch;
+    bool m_batchBySignOn;
+    bool m_started;
+};
+
+#endif // SOCIALDSYNCSCHEDULER_H
@@ -354,6 +354,7 @@ void TwitterDataTypeSyncAdaptor::signIn(Accounts::Account *account)
 
     session->setProperty("account", QVariant::fromValue<Accounts::Account*>(account));
     session->setProperty("identity", QVariant::fromValue<SignOn::Identity*>(identity));
+    startTraceSpan(SyncTrace::SignOn, accountId, session);
     session->process(SignOn::SessionData(signonSessionData), mechanism);
 }
 
@@ -372,6 +373,7 @@ void TwitterDataTypeSyncAdaptor::signOnError(const SignOn::Error &error)
         setCredentialsNeedUpdate(account);
     }
 
+    finishTraceSpan(session, -1);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
@@ -408,6 +410,7 @@ void TwitterDataTypeSyncAdaptor::signOnResponse(const SignOn::SessionData &respo
         SOCIALD_LOG_INFO("signon response for account with id" << accountId << "contained no oauth token secret");
     }
 
+    finishTraceSpan(session);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
@@ -28,9 +28,8 @@ QNetworkReply * VKContactImageDownloader::createReply(const QString &url,
 {
     Q_D(AbstractImageDownloader);
 
-    Q_UNUSED(metadata)
-
     QNetworkRequest request(url);
+    setConditionalHeaders(&request, metadata);
     return d->networkAccessManager->get(request);
 }
 
@@ -221,6 +221,7 @@ VKContactSyncAdaptor::VKContactSyncAdaptor(QObject *parent)
 {
     connect(m_workerObject, &AbstractImageDownloader::imageDownloaded,
             this, &VKContactSyncAdaptor::imageDownloaded);
+    m_workerObject->startWorkerThread();
 
     // can sync, enabled
     setInitialActive(true);
@@ -228,6 +229,7 @@ VKContactSyncAdaptor::VKContactSyncAdaptor(QObject *parent)
 
 VKContactSyncAdaptor::~VKContactSyncAdaptor()
 {
+    m_workerObject->stopWorkerThread();
     delete m_workerObject;
 }
 
@@ -378,6 +378,7 @@ void VKDataTypeSyncAdaptor::signIn(Accounts::Account *account)
 
     session->setProperty("account", QVariant::fromValue<Accounts::Account*>(account));
     session->setProperty("identity", QVariant::fromValue<SignOn::Identity*>(identity));
+    startTraceSpan(SyncTrace::SignOn, accountId, session);
     session->process(SignOn::SessionData(signonSessionData), mechanism);
 }
 
@@ -396,6 +397,7 @@ void VKDataTypeSyncAdaptor::signOnError(const SignOn::Error &error)
         setCredentialsNeedUpdate(account);
     }
 
+    finishTraceSpan(session, -1);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
@@ -425,6 +427,7 @@ void VKDataTypeSyncAdaptor::signOnResponse(const SignOn::SessionData &responseDa
         SOCIALD_LOG_INFO("signon response for account with id" << accountId << "contained no oauth token");
     }
 
+    finishTraceSpan(session);
     session->disconnect(this);
     identity->destroySession(session);
     identity->deleteLater();
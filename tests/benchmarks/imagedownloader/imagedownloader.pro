@@ -0,0 +1,14 @@
+# Standalone benchmark and resume test of the image downloader against a
+# local HTTP server. It is not part of the main build; run qmake on this
+# file directly.
+
+TEMPLATE = app
+TARGET = tst_imagedownloader
+
+QT += testlib
+
+CONFIG += testcase socialcache_images
+
+include(../socialcache.pri)
+
+SOURCES += $$PWD/tst_imagedownloader.cpp
@@ -0,0 +1,533 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#include "abstractimagedownloader.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEventLoop>
+#include <QtCore/QSet>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QTimer>
+#include <QtCore/QUrl>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtTest/QtTest>
+
+/*
+    Downloads thousands of images with AbstractImageDownloader, running on
+    its worker thread, from a local HTTP server standing in for an image
+    host. The server answers each request after a configurable latency,
+    sends the body at a configurable bandwidth per connection, and can add
+    latency for every other request it is serving at the time, like a host
+    that slows down under load.
+
+    hostWindow reports the time taken to download every image, and, from
+    the server's side, the peak and the average number of requests in
+    flight. The per host window should open up to the cap on a fast or a
+    high latency host, and stay narrow on a host that slows down as more
+    requests are sent to it.
+
+    resume has the server drop the connection halfway through the body of
+    an image. The partial file must be kept with its validator, and the
+    next downloader, as the next sync would create, must ask for the rest
+    with a Range request and end up with the whole image. If the image
+    changed in between, the server ignores the range and the download
+    starts over.
+*/
+
+namespace {
+    const int IMAGE_SIZE = 8 * 1024;
+    const int BANDWIDTH_INTERVAL = 10;      // msecs between two chunks of a body
+    const int MAXIMUM_DOWNLOADS = 8;
+    const int DOWNLOAD_TIMEOUT = 10 * 60 * 1000;
+    const int RESUME_TIMEOUT = 10000;
+
+    QByteArray imageContent(int size)
+    {
+        // Only the signature is checked
+        QByteArray content("\xFF\xD8\xFF\xE0");
+        content.append(QByteArray(size - content.size(), 'x'));
+        return content;
+    }
+}
+
+class ImageServer;
+
+// Answers the requests of one client connection, one at a time
+class ImageConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    ImageConnection(QTcpSocket *socket, ImageServer *server);
+
+private Q_SLOTS:
+    void readRequest();
+    void sendHeader();
+    void sendBody();
+    void disconnected();
+
+private:
+    void finishResponse();
+    void dropResponse();
+
+    QTcpSocket * const m_socket;
+    ImageServer * const m_server;
+    QByteArray m_received;      // not answered yet
+    QTimer m_latencyTimer;
+    QTimer m_bandwidthTimer;
+    QByteArray m_path;
+    int m_offset;               // first byte of the image sent, from a Range request
+    int m_sent;                 // bytes of the image sent, counting from its start
+    int m_dropAt;               // the connection is dropped there, or -1
+    bool m_responding;
+};
+
+class ImageServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    ImageServer(int latency, int bandwidth, int congestion, QObject *parent = 0)
+        : QTcpServer(parent)
+        , m_image(imageContent(IMAGE_SIZE))
+        , m_latency(latency), m_bandwidth(bandwidth), m_congestion(congestion)
+        , m_version(1), m_dropAfter(0)
+        , m_running(0), m_peakRunning(0), m_served(0), m_changed(0), m_runningTime(0)
+    {
+    }
+
+    // Cuts the first response for each image off after this many bytes
+    void setDropAfter(int bytes) { m_dropAfter = bytes; }
+
+    // Changes the ETag of every image, as if they had been replaced
+    void setVersion(int version) { m_version = version; }
+
+    QByteArray etag(const QByteArray &path) const
+    {
+        return '"' + path + '-' + QByteArray::number(m_version) + '"';
+    }
+
+    // Where to drop the response being sent for the image, or -1
+    int dropAt(const QByteArray &path)
+    {
+        if (m_dropAfter <= 0 || m_dropped.contains(path)) {
+            return -1;
+        }
+        m_dropped.insert(path);
+        return m_dropAfter;
+    }
+
+    // Range headers of the requests received, empty for none
+    void requestReceived(const QByteArray &range) { m_ranges.append(range); }
+    QList<QByteArray> ranges() const { return m_ranges; }
+
+    QString url(int image) const
+    {
+        return QStringLiteral("http://127.0.0.1:%1/images/%2.jpg").arg(serverPort()).arg(image);
+    }
+
+    const QByteArray &image() const { return m_image; }
+
+    // Latency of a request started now, grown by the others in flight
+    int latency() const { return m_latency + m_congestion * qMax(0, m_running - 1); }
+
+    int chunkSize() const
+    {
+        return m_bandwidth > 0 ? qMax(1, m_bandwidth * BANDWIDTH_INTERVAL / 1000) : m_image.size();
+    }
+
+    void responseStarted() { updateRunning(1); }
+    void responseFinished(bool complete)
+    {
+        if (complete) {
+            ++m_served;
+        }
+        updateRunning(-1);
+    }
+
+    int served() const { return m_served; }
+    int peakRunning() const { return m_peakRunning; }
+    qreal averageRunning() const
+    {
+        return m_changed > 0 ? m_runningTime / m_changed : 0;
+    }
+
+protected:
+    void incomingConnection(qintptr socketDescriptor)
+    {
+        QTcpSocket *socket = new QTcpSocket(this);
+        if (socket->setSocketDescriptor(socketDescriptor)) {
+            new ImageConnection(socket, this);
+        } else {
+            delete socket;
+        }
+    }
+
+private:
+    void updateRunning(int change)
+    {
+        if (!m_clock.isValid()) {
+            m_clock.start();
+        }
+        const qint64 now = m_clock.elapsed();
+        m_runningTime += qreal(m_running) * (now - m_changed);
+        m_changed = now;
+
+        m_running += change;
+        m_peakRunning = qMax(m_peakRunning, m_running);
+    }
+
+    const QByteArray m_image;
+    const int m_latency;        // msecs
+    const int m_bandwidth;      // bytes per second and connection, 0 for unlimited
+    const int m_congestion;     // msecs added per other request in flight
+    int m_version;
+    int m_dropAfter;
+    QSet<QByteArray> m_dropped;
+    QList<QByteArray> m_ranges;
+    int m_running;
+    int m_peakRunning;
+    int m_served;
+    QElapsedTimer m_clock;      // started with the first request
+    qint64 m_changed;           // msecs, when m_running last changed
+    qreal m_runningTime;        // requests in flight integrated over msecs
+};
+
+ImageConnection::ImageConnection(QTcpSocket *socket, ImageServer *server)
+    : QObject(socket), m_socket(socket), m_server(server)
+    , m_offset(0), m_sent(0), m_dropAt(-1), m_responding(false)
+{
+    m_latencyTimer.setSingleShot(true);
+    m_bandwidthTimer.setInterval(BANDWIDTH_INTERVAL);
+    connect(&m_latencyTimer, SIGNAL(timeout()), this, SLOT(sendHeader()));
+    connect(&m_bandwidthTimer, SIGNAL(timeout()), this, SLOT(sendBody()));
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+    connect(m_socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+}
+
+void ImageConnection::readRequest()
+{
+    m_received.append(m_socket->readAll());
+    if (m_responding) {
+        return;
+    }
+
+    // Every request is a GET of an image, only its range matters
+    const int end = m_received.indexOf("\r\n\r\n");
+    if (end < 0) {
+        return;
+    }
+    const QList<QByteArray> lines = m_received.left(end).split('\n');
+    m_received.remove(0, end + 4);
+
+    QByteArray range;
+    QByteArray ifRange;
+    for (int i = 1; i < lines.count(); ++i) {
+        const int colon = lines.at(i).indexOf(':');
+        const QByteArray name = lines.at(i).left(colon).trimmed().toLower();
+        if (name == "range") {
+            range = lines.at(i).mid(colon + 1).trimmed();
+        } else if (name == "if-range") {
+            ifRange = lines.at(i).mid(colon + 1).trimmed();
+        }
+    }
+    m_path = lines.first().split(' ').value(1);
+    m_server->requestReceived(range);
+
+    // The range is only honoured while the image is the same
+    m_offset = 0;
+    if (range.startsWith("bytes=") && range.endsWith('-') && ifRange == m_server->etag(m_path)) {
+        m_offset = range.mid(6, range.size() - 7).toInt();
+        if (m_offset >= m_server->image().size()) {
+            m_offset = 0;
+        }
+    }
+
+    m_responding = true;
+    m_server->responseStarted();
+    m_latencyTimer.start(m_server->latency());
+}
+
+void ImageConnection::sendHeader()
+{
+    const int size = m_server->image().size();
+    QByteArray header(m_offset > 0 ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n");
+    header += "Content-Type: image/jpeg\r\n";
+    header += "Content-Length: " + QByteArray::number(size - m_offset) + "\r\n";
+    header += "ETag: " + m_server->etag(m_path) + "\r\n";
+    if (m_offset > 0) {
+        header += "Content-Range: bytes " + QByteArray::number(m_offset) + '-'
+                + QByteArray::number(size - 1) + '/' + QByteArray::number(size) + "\r\n";
+    }
+    header += "\r\n";
+    m_socket->write(header);
+
+    m_sent = m_offset;
+    m_dropAt = m_server->dropAt(m_path);
+    m_bandwidthTimer.start();
+    sendBody();
+}
+
+void ImageConnection::sendBody()
+{
+    const QByteArray &image = m_server->image();
+    const int end = m_dropAt >= 0 ? qMin(m_dropAt, image.size()) : image.size();
+    const int size = qMin(m_server->chunkSize(), end - m_sent);
+    m_socket->write(image.constData() + m_sent, size);
+    m_sent += size;
+    if (m_sent == image.size()) {
+        finishResponse();
+    } else if (m_sent == end) {
+        dropResponse();
+    }
+}
+
+void ImageConnection::finishResponse()
+{
+    m_bandwidthTimer.stop();
+    m_responding = false;
+    m_server->responseFinished(true);
+
+    // The client may have sent its next request already
+    readRequest();
+}
+
+// Closes the connection with the body incomplete, like a lost link
+void ImageConnection::dropResponse()
+{
+    m_bandwidthTimer.stop();
+    m_responding = false;
+    m_server->responseFinished(false);
+    m_socket->disconnectFromHost();
+}
+
+void ImageConnection::disconnected()
+{
+    if (m_responding) {
+        m_latencyTimer.stop();
+        m_bandwidthTimer.stop();
+        m_responding = false;
+        m_server->responseFinished(false);
+    }
+    m_socket->deleteLater();
+}
+
+class BenchmarkDownloader : public AbstractImageDownloader
+{
+    Q_OBJECT
+
+public:
+    BenchmarkDownloader(const QString &directory, int maximumHostDownloads)
+        : m_directory(directory)
+        , m_networkAccessManager(new QNetworkAccessManager(this))
+    {
+        setDownloadLimits(MAXIMUM_DOWNLOADS, maximumHostDownloads);
+    }
+
+protected:
+    // The default one logs every request
+    QNetworkReply *createReply(const QString &url, const QVariantMap &metadata)
+    {
+        QNetworkRequest request(url);
+        setConditionalHeaders(&request, metadata);
+        return m_networkAccessManager->get(request);
+    }
+
+    QString outputFile(const QString &url, const QVariantMap &metadata) const
+    {
+        Q_UNUSED(metadata)
+        return m_directory + QLatin1Char('/') + QUrl(url).fileName();
+    }
+
+private:
+    const QString m_directory;
+    QNetworkAccessManager * const m_networkAccessManager;
+};
+
+// Quits its event loop once every queued image is reported
+class DownloadCounter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DownloadCounter(int expected) : expected(expected), downloaded(0), failed(0) {}
+
+    QEventLoop loop;
+    const int expected;
+    int downloaded;
+    int failed;
+    QString lastPath;
+
+public Q_SLOTS:
+    void imageDownloaded(const QString &url, const QString &path, const QVariantMap &metadata)
+    {
+        Q_UNUSED(url)
+        Q_UNUSED(metadata)
+        lastPath = path;
+        if (path.isEmpty()) {
+            ++failed;
+        } else {
+            ++downloaded;
+        }
+        if (downloaded + failed == expected) {
+            loop.quit();
+        }
+    }
+};
+
+class tst_ImageDownloader : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void hostWindow_data();
+    void hostWindow();
+    void resume_data();
+    void resume();
+
+private:
+    QString download(const QString &directory, const QString &url);
+};
+
+void tst_ImageDownloader::hostWindow_data()
+{
+    QTest::addColumn<int>("imageCount");
+    QTest::addColumn<int>("latency");
+    QTest::addColumn<int>("bandwidth");
+    QTest::addColumn<int>("congestion");
+    QTest::addColumn<int>("maximumHostDownloads");
+
+    QTest::newRow("local") << 5000 << 0 << 0 << 0 << 6;
+    QTest::newRow("cdn") << 5000 << 50 << 2 * 1024 * 1024 << 0 << 6;
+    QTest::newRow("cdn, one per host") << 1000 << 50 << 2 * 1024 * 1024 << 0 << 1;
+    QTest::newRow("slow link") << 1000 << 150 << 64 * 1024 << 0 << 6;
+    QTest::newRow("congested") << 2000 << 20 << 2 * 1024 * 1024 << 40 << 6;
+}
+
+void tst_ImageDownloader::hostWindow()
+{
+    QFETCH(int, imageCount);
+    QFETCH(int, latency);
+    QFETCH(int, bandwidth);
+    QFETCH(int, congestion);
+    QFETCH(int, maximumHostDownloads);
+
+    ImageServer server(latency, bandwidth, congestion);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    BenchmarkDownloader downloader(directory.path(), maximumHostDownloads);
+    DownloadCounter counter(imageCount);
+    connect(&downloader, SIGNAL(imageDownloaded(QString,QString,QVariantMap)),
+            &counter, SLOT(imageDownloaded(QString,QString,QVariantMap)));
+    downloader.startWorkerThread();
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < imageCount; ++i) {
+        downloader.queue(server.url(i), QVariantMap());
+    }
+    QTimer::singleShot(DOWNLOAD_TIMEOUT, &counter.loop, SLOT(quit()));
+    counter.loop.exec();
+    const qint64 elapsed = timer.elapsed();
+
+    downloader.stopWorkerThread();
+
+    qDebug() << "images:" << counter.downloaded << "failed:" << counter.failed
+             << "per second:" << (elapsed > 0 ? counter.downloaded * 1000 / elapsed : 0)
+             << "in flight, peak:" << server.peakRunning()
+             << "average:" << server.averageRunning();
+
+    QCOMPARE(counter.downloaded, imageCount);
+    QCOMPARE(server.served(), imageCount);
+    QVERIFY(server.peakRunning() <= maximumHostDownloads);
+    QTest::setBenchmarkResult(elapsed, QTest::WalltimeMilliseconds);
+}
+
+// Downloads one image with a downloader of its own, returns its file
+QString tst_ImageDownloader::download(const QString &directory, const QString &url)
+{
+    BenchmarkDownloader downloader(directory, 1);
+    DownloadCounter counter(1);
+    connect(&downloader, SIGNAL(imageDownloaded(QString,QString,QVariantMap)),
+            &counter, SLOT(imageDownloaded(QString,QString,QVariantMap)));
+
+    downloader.queue(url, QVariantMap());
+    if (counter.downloaded + counter.failed < counter.expected) {
+        QTimer::singleShot(RESUME_TIMEOUT, &counter.loop, SLOT(quit()));
+        counter.loop.exec();
+    }
+    return counter.lastPath;
+}
+
+void tst_ImageDownloader::resume_data()
+{
+    QTest::addColumn<bool>("changed");
+
+    QTest::newRow("same image") << false;
+    QTest::newRow("changed image") << true;
+}
+
+void tst_ImageDownloader::resume()
+{
+    QFETCH(bool, changed);
+
+    ImageServer server(0, 0, 0);
+    server.setDropAfter(IMAGE_SIZE / 2);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString url = server.url(0);
+    const QString fileName = directory.path() + QStringLiteral("/0.jpg");
+    const QString partialName = fileName + QStringLiteral(".part");
+    const QString validatorName = partialName + QStringLiteral(".validator");
+
+    // The connection drops halfway through the body
+    QCOMPARE(download(directory.path(), url), QString());
+    QVERIFY(!QFile::exists(fileName));
+    QCOMPARE(QFileInfo(partialName).size(), qint64(IMAGE_SIZE / 2));
+    QVERIFY(QFile::exists(validatorName));
+
+    if (changed) {
+        server.setVersion(2);
+    }
+
+    QCOMPARE(download(directory.path(), url), fileName);
+    QCOMPARE(server.ranges(), QList<QByteArray>()
+             << QByteArray()
+             << "bytes=" + QByteArray::number(IMAGE_SIZE / 2) + '-');
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), server.image());
+    QVERIFY(!QFile::exists(partialName));
+    QVERIFY(!QFile::exists(validatorName));
+}
+
+QTEST_GUILESS_MAIN(tst_ImageDownloader)
+
+#include "tst_imagedownloader.moc"
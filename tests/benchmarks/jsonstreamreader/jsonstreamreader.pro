@@ -0,0 +1,19 @@
+# Standalone benchmark of JsonStreamReader against QJsonDocument. It is not
+# part of the main build; run qmake on this file directly.
+
+TEMPLATE = app
+TARGET = tst_jsonstreamreader
+
+QT -= gui
+QT += testlib
+
+CONFIG += testcase
+
+INCLUDEPATH += $$PWD/../../../src/common
+
+HEADERS += $$PWD/../../../src/common/jsonstreamreader.h
+SOURCES += \
+    $$PWD/../../../src/common/jsonstreamreader.cpp \
+    $$PWD/tst_jsonstreamreader.cpp
+
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
@@ -0,0 +1,340 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#include "jsonstreamreader.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtTest/QtTest>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+/*
+    Compares reading the "data" array of recorded responses with
+    JsonStreamReader, fed in network sized chunks, against parsing the
+    whole reply into a QJsonDocument as the handlers used to.
+
+    Three ways of reading are measured, each for time and for the peak
+    heap in use while reading:
+    - document: the reply is buffered and parsed with QJsonDocument.
+    - buffered: the chunks are added to the reader as they arrive, and
+      the elements are only taken after finish(). This is what the album
+      handlers ship, as an album is only applied once the whole reply is
+      known to be good.
+    - stream: the elements are taken as soon as each chunk completes them.
+
+    The peak heap is sampled from mallinfo after every step, so it needs
+    glibc and is reported as 0 elsewhere.
+
+    The responses are read from data/, or from the directory named by
+    SOCIALD_BENCHMARK_DATA. Each is also expanded to a page of 2000
+    elements, the limit the album requests use.
+*/
+
+namespace {
+    const int CHUNK_SIZE = 16 * 1024;
+    const int LARGE_PAGE_SIZE = 2000;
+
+    QByteArray largePage(const QByteArray &response)
+    {
+        QJsonObject object = QJsonDocument::fromJson(response).object();
+        const QJsonArray data = object.value(QLatin1String("data")).toArray();
+        if (data.isEmpty()) {
+            return QByteArray();
+        }
+
+        QJsonArray page;
+        while (page.size() < LARGE_PAGE_SIZE) {
+            page.append(data.at(page.size() % data.size()));
+        }
+        object.insert(QLatin1String("data"), page);
+        return QJsonDocument(object).toJson(QJsonDocument::Compact);
+    }
+
+    qint64 heapInUse()
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+        return mallinfo().uordblks;
+#else
+        return 0;
+#endif
+    }
+
+    // Peak heap growth over the heap in use when it was created
+    class HeapPeak
+    {
+    public:
+        HeapPeak() : m_base(heapInUse()), m_peak(0) {}
+
+        void sample() { m_peak = qMax(m_peak, heapInUse() - m_base); }
+        qint64 peak() const { return m_peak; }
+
+    private:
+        const qint64 m_base;
+        qint64 m_peak;
+    };
+
+    QByteArray chunk(const QByteArray &response, int offset)
+    {
+        return QByteArray::fromRawData(response.constData() + offset,
+                                       qMin(CHUNK_SIZE, response.size() - offset));
+    }
+
+    int readDocument(const QByteArray &response, HeapPeak *heap = 0)
+    {
+        // The reply buffers every chunk until it is finished
+        QByteArray replyData;
+        for (int offset = 0; offset < response.size(); offset += CHUNK_SIZE) {
+            replyData.append(chunk(response, offset));
+            if (heap) {
+                heap->sample();
+            }
+        }
+
+        const QJsonDocument document = QJsonDocument::fromJson(replyData);
+        if (heap) {
+            heap->sample();
+        }
+        const QJsonArray data = document.object().value(QLatin1String("data")).toArray();
+        if (heap) {
+            heap->sample();
+        }
+
+        int count = 0;
+        for (int i = 0; i < data.size(); ++i) {
+            if (!data.at(i).toObject().isEmpty()) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    int readElements(JsonStreamReader *reader, QList<QJsonValue> *elements, HeapPeak *heap)
+    {
+        int count = 0;
+        QJsonValue element;
+        while (reader->readElement(&element)) {
+            if (!element.toObject().isEmpty()) {
+                ++count;
+            }
+            if (elements) {
+                elements->append(element);
+            }
+            if (heap) {
+                heap->sample();
+            }
+        }
+        return count;
+    }
+
+    int readBuffered(const QByteArray &response, QList<QJsonValue> *elements = 0, HeapPeak *heap = 0)
+    {
+        JsonStreamReader reader(QStringLiteral("data"));
+        for (int offset = 0; offset < response.size(); offset += CHUNK_SIZE) {
+            reader.addData(chunk(response, offset));
+            if (heap) {
+                heap->sample();
+            }
+        }
+        if (!reader.finish()) {
+            return -1;
+        }
+        return readElements(&reader, elements, heap);
+    }
+
+    int readStream(const QByteArray &response, QList<QJsonValue> *elements = 0, HeapPeak *heap = 0)
+    {
+        JsonStreamReader reader(QStringLiteral("data"));
+        int count = 0;
+        for (int offset = 0; offset < response.size(); offset += CHUNK_SIZE) {
+            reader.addData(chunk(response, offset));
+            count += readElements(&reader, elements, heap);
+        }
+        return reader.finish() ? count : -1;
+    }
+}
+
+class tst_JsonStreamReader : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void matchesDocument_data();
+    void matchesDocument();
+    void document_data();
+    void document();
+    void buffered_data();
+    void buffered();
+    void stream_data();
+    void stream();
+    void documentMemory_data();
+    void documentMemory();
+    void bufferedMemory_data();
+    void bufferedMemory();
+    void streamMemory_data();
+    void streamMemory();
+
+private:
+    void addResponses();
+};
+
+void tst_JsonStreamReader::addResponses()
+{
+    QTest::addColumn<QByteArray>("response");
+
+    const QString dataDir = qEnvironmentVariableIsSet("SOCIALD_BENCHMARK_DATA")
+            ? QString::fromLocal8Bit(qgetenv("SOCIALD_BENCHMARK_DATA"))
+            : QStringLiteral(SRCDIR "data");
+    const QStringList fileNames = QDir(dataDir).entryList(QStringList() << QStringLiteral("*.json"),
+                                                          QDir::Files, QDir::Name);
+    Q_FOREACH (const QString &fileName, fileNames) {
+        QFile file(QDir(dataDir).filePath(fileName));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        const QByteArray response = file.readAll();
+        QTest::newRow(qPrintable(fileName)) << response;
+
+        const QByteArray page = largePage(response);
+        if (!page.isEmpty()) {
+            QTest::newRow(qPrintable(fileName + QStringLiteral(" x") + QString::number(LARGE_PAGE_SIZE)))
+                    << page;
+        }
+    }
+}
+
+void tst_JsonStreamReader::matchesDocument_data()
+{
+    addResponses();
+}
+
+void tst_JsonStreamReader::matchesDocument()
+{
+    QFETCH(QByteArray, response);
+
+    QList<QJsonValue> elements;
+    QCOMPARE(readStream(response, &elements), readDocument(response));
+
+    QList<QJsonValue> bufferedElements;
+    QCOMPARE(readBuffered(response, &bufferedElements), readDocument(response));
+
+    const QJsonArray data = QJsonDocument::fromJson(response).object()
+            .value(QLatin1String("data")).toArray();
+    QCOMPARE(elements.size(), data.size());
+    QCOMPARE(bufferedElements.size(), data.size());
+    for (int i = 0; i < data.size(); ++i) {
+        QCOMPARE(elements.at(i), data.at(i));
+        QCOMPARE(bufferedElements.at(i), data.at(i));
+    }
+}
+
+void tst_JsonStreamReader::document_data()
+{
+    addResponses();
+}
+
+void tst_JsonStreamReader::document()
+{
+    QFETCH(QByteArray, response);
+
+    QBENCHMARK {
+        readDocument(response);
+    }
+}
+
+void tst_JsonStreamReader::buffered_data()
+{
+    addResponses();
+}
+
+void tst_JsonStreamReader::buffered()
+{
+    QFETCH(QByteArray, response);
+
+    QBENCHMARK {
+        readBuffered(response);
+    }
+}
+
+void tst_JsonStreamReader::stream_data()
+{
+    addResponses();
+}
+
+void tst_JsonStreamReader::stream()
+{
+    QFETCH(QByteArray, response);
+
+    QBENCHMARK {
+        readStream(response);
+    }
+}
+
+void tst_JsonStreamReader::documentMemory_data()
+{
+    addResponses();
+}
+
+void tst_JsonStreamReader::documentMemory()
+{
+    QFETCH(QByteArray, response);
+
+    HeapPeak heap;
+    readDocument(response, &heap);
+    QTest::setBenchmarkResult(heap.peak(), QTest::BytesAllocated);
+}
+
+void tst_JsonStreamReader::bufferedMemory_data()
+{
+    addResponses();
+}
+
+void tst_JsonStreamReader::bufferedMemory()
+{
+    QFETCH(QByteArray, response);
+
+    HeapPeak heap;
+    readBuffered(response, 0, &heap);
+    QTest::setBenchmarkResult(heap.peak(), QTest::BytesAllocated);
+}
+
+void tst_JsonStreamReader::streamMemory_data()
+{
+    addResponses();
+}
+
+void tst_JsonStreamReader::streamMemory()
+{
+    QFETCH(QByteArray, response);
+
+    HeapPeak heap;
+    readStream(response, 0, &heap);
+    QTest::setBenchmarkResult(heap.peak(), QTest::BytesAllocated);
+}
+
+QTEST_GUILESS_MAIN(tst_JsonStreamReader)
+
+#include "tst_jsonstreamreader.moc"
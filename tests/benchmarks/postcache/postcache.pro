@@ -0,0 +1,14 @@
+# Standalone benchmark of the post cache loader. It is not part of the
+# main build; run qmake on this file directly.
+
+TEMPLATE = app
+TARGET = tst_postcache
+
+QT -= gui
+QT += testlib
+
+CONFIG += testcase
+
+include(../socialcache.pri)
+
+SOURCES += $$PWD/tst_postcache.cpp
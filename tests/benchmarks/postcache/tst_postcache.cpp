@@ -0,0 +1,522 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#include "abstractsocialpostcachedatabase.h"
+#include "socialsyncinterface.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStandardPaths>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+#include <QtTest/QtTest>
+
+#include <algorithm>
+
+/*
+    Compares AbstractSocialPostCacheDatabase::read(), which loads the posts,
+    images, extra data and account links with one statement each, against
+    the loader it replaced, which ran an images and an extra query for
+    every post. Both read caches of 1k, 10k and 50k posts, and must return
+    the same posts().
+
+    The account filter is measured on a cache of 20k posts spread across 5
+    accounts: read() keeps the filter in a temporary table that its
+    statements join, the old loader spliced the matching account and post
+    ids into IN lists, and so prepared new statements on every refresh.
+
+    readLatency measures how long a refresh() of one page takes while
+    another database object of the same file keeps committing 5k posts at
+    a time. Reads have worker threads and connections of their own, and
+    the database is in WAL mode, so they should not wait for the writes.
+
+    The databases are written under the test mode data location, so the
+    cache of the running device is not touched.
+*/
+
+namespace {
+    const char *PHOTO = "photo";
+    const char *VIDEO = "video";
+
+    const int ACCOUNT_COUNT = 5;
+    const int FILTERED_POST_COUNT = 20000;
+    const int WRITE_POST_COUNT = 5000;
+    const int WRITE_ROUNDS = 5;
+    const int READ_PAGE_SIZE = 50;
+
+    QString databaseFile(int postCount)
+    {
+        return QStringLiteral("benchmark-posts-%1.db").arg(postCount);
+    }
+
+    QString databasePath(int postCount)
+    {
+        return QString(PRIVILEGED_DATA_DIR)
+                + SocialSyncInterface::dataType(SocialSyncInterface::Posts)
+                + QLatin1Char('/') + databaseFile(postCount);
+    }
+
+    // Every post has an icon and a photo, every fourth a video too. Every
+    // tenth post also belongs to a second account.
+    void queuePosts(AbstractSocialPostCacheDatabase *database, int postCount, int first = 0)
+    {
+        const QDateTime start = QDateTime::fromTime_t(1500000000);
+        for (int i = first; i < first + postCount; ++i) {
+            const QString identifier = QStringLiteral("post-%1").arg(i, 6, 10, QLatin1Char('0'));
+
+            QList<QPair<QString, SocialPostImage::ImageType> > images;
+            images.append(qMakePair(QStringLiteral("https://example.com/photos/%1.jpg").arg(i),
+                                    SocialPostImage::Photo));
+            if (i % 4 == 0) {
+                images.append(qMakePair(QStringLiteral("https://example.com/videos/%1.mp4").arg(i),
+                                        SocialPostImage::Video));
+            }
+
+            QVariantMap extra;
+            extra.insert(QStringLiteral("likes"), i % 97);
+            extra.insert(QStringLiteral("comments"), i % 13);
+            extra.insert(QStringLiteral("link"), QStringLiteral("https://example.com/posts/%1").arg(i));
+
+            const QString name = QStringLiteral("Author %1").arg(i % 50);
+            const QString body = QStringLiteral("Post %1 of the benchmark feed").arg(i);
+            const QString icon = QStringLiteral("https://example.com/avatars/%1.jpg").arg(i % 50);
+            // Distinct timestamps, as the old loader ordered by timestamp only
+            const QDateTime timestamp = start.addSecs(i * 60);
+
+            database->addPost(identifier, name, body, timestamp, icon, images, extra,
+                              i % ACCOUNT_COUNT + 1);
+            if (i % 10 == 0) {
+                database->addPost(identifier, name, body, timestamp, icon, images, extra,
+                                  (i + 1) % ACCOUNT_COUNT + 1);
+            }
+        }
+    }
+
+    void addPosts(AbstractSocialPostCacheDatabase *database, int postCount)
+    {
+        queuePosts(database, postCount);
+        database->commit();
+        database->wait();
+    }
+
+    qint64 percentile(QList<qint64> values, int percent)
+    {
+        if (values.isEmpty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        return values.at(qMin(values.count() - 1, values.count() * percent / 100));
+    }
+
+    // The loader read() used before, with one images and one extra query
+    // per post, and the account filter spliced into IN lists.
+    QList<SocialPost::ConstPtr> loadPerPost(QSqlDatabase database,
+                                            const QVariantList &accountIdFilter = QVariantList())
+    {
+        QList<SocialPost::ConstPtr> posts;
+
+        QString accountQueryString = QStringLiteral("SELECT account, postId FROM link_post_account");
+        if (!accountIdFilter.isEmpty()) {
+            QStringList accountIds;
+            Q_FOREACH (const QVariant &accountId, accountIdFilter) {
+                accountIds.append(accountId.toString());
+            }
+            accountQueryString += " WHERE account IN (" + accountIds.join(',') + ')';
+        }
+
+        QSqlQuery accountQuery(database);
+        if (!accountQuery.exec(accountQueryString)) {
+            qWarning() << accountQuery.lastError();
+            return posts;
+        }
+        QStringList filteredPostIds;
+        QHash<QString, QList<int> > accounts;
+        while (accountQuery.next()) {
+            const QString postId = accountQuery.value(1).toString();
+            accounts[postId].append(accountQuery.value(0).toInt());
+            filteredPostIds.append(postId);
+        }
+
+        QString postQueryString = QStringLiteral("SELECT identifier, name, body, timestamp FROM posts");
+        if (!accountIdFilter.isEmpty()) {
+            postQueryString += " WHERE identifier IN (\"" + filteredPostIds.join("\",\"") + "\")";
+        }
+        postQueryString += QStringLiteral(" ORDER BY timestamp DESC");
+
+        QSqlQuery postQuery(database);
+        QSqlQuery imageQuery(database);
+        QSqlQuery extraQuery(database);
+        imageQuery.prepare(QStringLiteral(
+                    "SELECT position, url, type FROM images "
+                    "WHERE postId = :postId ORDER BY position"));
+        extraQuery.prepare(QStringLiteral(
+                    "SELECT key, value FROM extra WHERE postId = :postId"));
+        if (!postQuery.exec(postQueryString)) {
+            qWarning() << postQuery.lastError();
+            return posts;
+        }
+
+        while (postQuery.next()) {
+            const QString identifier = postQuery.value(0).toString();
+            SocialPost::Ptr post = SocialPost::create(identifier,
+                                                      postQuery.value(1).toString(),
+                                                      postQuery.value(2).toString(),
+                                                      QDateTime::fromTime_t(postQuery.value(3).toInt()));
+
+            imageQuery.bindValue(QStringLiteral(":postId"), identifier);
+            QMap<int, SocialPostImage::ConstPtr> images;
+            if (imageQuery.exec()) {
+                while (imageQuery.next()) {
+                    SocialPostImage::ImageType type = SocialPostImage::Invalid;
+                    const QString typeString = imageQuery.value(2).toString();
+                    if (typeString == QLatin1String(PHOTO)) {
+                        type = SocialPostImage::Photo;
+                    } else if (typeString == QLatin1String(VIDEO)) {
+                        type = SocialPostImage::Video;
+                    }
+                    images.insert(imageQuery.value(0).toInt(),
+                                  SocialPostImage::create(imageQuery.value(1).toString(), type));
+                }
+            }
+            post->setImages(images);
+
+            extraQuery.bindValue(QStringLiteral(":postId"), identifier);
+            QVariantMap extra;
+            if (extraQuery.exec()) {
+                while (extraQuery.next()) {
+                    extra.insert(extraQuery.value(0).toString(), extraQuery.value(1));
+                }
+            }
+            post->setExtra(extra);
+            post->setAccounts(accounts.value(identifier));
+
+            posts.append(post);
+        }
+
+        return posts;
+    }
+}
+
+class tst_PostCache : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void samePosts_data();
+    void samePosts();
+    void perPostLoader_data();
+    void perPostLoader();
+    void setBasedLoader_data();
+    void setBasedLoader();
+
+    void sameFilteredPosts_data();
+    void sameFilteredPosts();
+    void inListFilter_data();
+    void inListFilter();
+    void tempTableFilter_data();
+    void tempTableFilter();
+
+    void readLatency_data();
+    void readLatency();
+
+private:
+    void addPostCounts();
+    void addAccountFilters();
+    void comparePosts(const QList<SocialPost::ConstPtr> &posts,
+                      const QList<SocialPost::ConstPtr> &perPostPosts);
+    AbstractSocialPostCacheDatabase *database(int postCount);
+    QSqlDatabase perPostConnection(int postCount);
+
+    QHash<int, QSharedPointer<AbstractSocialPostCacheDatabase> > m_databases;
+};
+
+void tst_PostCache::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void tst_PostCache::cleanupTestCase()
+{
+    const QList<int> postCounts = m_databases.keys();
+    m_databases.clear();
+    Q_FOREACH (int postCount, postCounts) {
+        QSqlDatabase::removeDatabase(databaseFile(postCount));
+        QFile::remove(databasePath(postCount));
+        QFile::remove(databasePath(postCount) + QStringLiteral("-wal"));
+        QFile::remove(databasePath(postCount) + QStringLiteral("-shm"));
+        QFile::remove(databasePath(postCount) + QStringLiteral(".lock"));
+    }
+}
+
+void tst_PostCache::addPostCounts()
+{
+    QTest::addColumn<int>("postCount");
+
+    QTest::newRow("1k posts") << 1000;
+    QTest::newRow("10k posts") << 10000;
+    QTest::newRow("50k posts") << 50000;
+}
+
+// Created and filled on first use, then shared by the tests
+AbstractSocialPostCacheDatabase *tst_PostCache::database(int postCount)
+{
+    QSharedPointer<AbstractSocialPostCacheDatabase> database = m_databases.value(postCount);
+    if (!database) {
+        QFile::remove(databasePath(postCount));
+        database = QSharedPointer<AbstractSocialPostCacheDatabase>(
+                    new AbstractSocialPostCacheDatabase(QStringLiteral("benchmark"),
+                                                        databaseFile(postCount)));
+        addPosts(database.data(), postCount);
+        m_databases.insert(postCount, database);
+    }
+    return database.data();
+}
+
+QSqlDatabase tst_PostCache::perPostConnection(int postCount)
+{
+    const QString connectionName = databaseFile(postCount);
+    if (QSqlDatabase::contains(connectionName)) {
+        return QSqlDatabase::database(connectionName);
+    }
+    QSqlDatabase connection = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+    connection.setDatabaseName(databasePath(postCount));
+    connection.open();
+    return connection;
+}
+
+void tst_PostCache::comparePosts(const QList<SocialPost::ConstPtr> &posts,
+                                 const QList<SocialPost::ConstPtr> &perPostPosts)
+{
+    QCOMPARE(perPostPosts.count(), posts.count());
+    for (int i = 0; i < posts.count(); ++i) {
+        const SocialPost::ConstPtr &post = posts.at(i);
+        const SocialPost::ConstPtr &perPostPost = perPostPosts.at(i);
+
+        QCOMPARE(post->identifier(), perPostPost->identifier());
+        QCOMPARE(post->name(), perPostPost->name());
+        QCOMPARE(post->body(), perPostPost->body());
+        QCOMPARE(post->timestamp(), perPostPost->timestamp());
+        QCOMPARE(post->extra(), perPostPost->extra());
+        // The link rows of a post come in the order of the index used
+        QList<int> accounts = post->accounts();
+        QList<int> perPostAccounts = perPostPost->accounts();
+        std::sort(accounts.begin(), accounts.end());
+        std::sort(perPostAccounts.begin(), perPostAccounts.end());
+        QCOMPARE(accounts, perPostAccounts);
+
+        const QMap<int, SocialPostImage::ConstPtr> images = post->allImages();
+        const QMap<int, SocialPostImage::ConstPtr> perPostImages = perPostPost->allImages();
+        QCOMPARE(images.keys(), perPostImages.keys());
+        Q_FOREACH (int position, images.keys()) {
+            QCOMPARE(images.value(position)->url(), perPostImages.value(position)->url());
+            QCOMPARE(images.value(position)->type(), perPostImages.value(position)->type());
+        }
+    }
+}
+
+void tst_PostCache::samePosts_data()
+{
+    addPostCounts();
+}
+
+void tst_PostCache::samePosts()
+{
+    QFETCH(int, postCount);
+
+    AbstractSocialPostCacheDatabase *setBased = database(postCount);
+    setBased->refresh();
+    setBased->wait();
+    const QList<SocialPost::ConstPtr> posts = setBased->posts();
+    const QList<SocialPost::ConstPtr> perPostPosts = loadPerPost(perPostConnection(postCount));
+
+    QCOMPARE(posts.count(), postCount);
+    comparePosts(posts, perPostPosts);
+}
+
+void tst_PostCache::perPostLoader_data()
+{
+    addPostCounts();
+}
+
+void tst_PostCache::perPostLoader()
+{
+    QFETCH(int, postCount);
+
+    database(postCount);
+    QSqlDatabase connection = perPostConnection(postCount);
+
+    QBENCHMARK {
+        loadPerPost(connection);
+    }
+}
+
+void tst_PostCache::setBasedLoader_data()
+{
+    addPostCounts();
+}
+
+void tst_PostCache::setBasedLoader()
+{
+    QFETCH(int, postCount);
+
+    AbstractSocialPostCacheDatabase *setBased = database(postCount);
+
+    QBENCHMARK {
+        setBased->refresh();
+        setBased->wait();
+    }
+    QCOMPARE(setBased->posts().count(), postCount);
+}
+
+void tst_PostCache::addAccountFilters()
+{
+    QTest::addColumn<QVariantList>("accountIdFilter");
+
+    QTest::newRow("1 of 5 accounts") << (QVariantList() << 1);
+    QTest::newRow("2 of 5 accounts") << (QVariantList() << 1 << 2);
+    QTest::newRow("4 of 5 accounts") << (QVariantList() << 1 << 2 << 3 << 4);
+}
+
+void tst_PostCache::sameFilteredPosts_data()
+{
+    addAccountFilters();
+}
+
+void tst_PostCache::sameFilteredPosts()
+{
+    QFETCH(QVariantList, accountIdFilter);
+
+    AbstractSocialPostCacheDatabase *setBased = database(FILTERED_POST_COUNT);
+    setBased->setAccountIdFilter(accountIdFilter);
+    setBased->refresh();
+    setBased->wait();
+    const QList<SocialPost::ConstPtr> posts = setBased->posts();
+    setBased->setAccountIdFilter(QVariantList());
+
+    QVERIFY(!posts.isEmpty());
+    comparePosts(posts, loadPerPost(perPostConnection(FILTERED_POST_COUNT), accountIdFilter));
+}
+
+void tst_PostCache::inListFilter_data()
+{
+    addAccountFilters();
+}
+
+void tst_PostCache::inListFilter()
+{
+    QFETCH(QVariantList, accountIdFilter);
+
+    database(FILTERED_POST_COUNT);
+    QSqlDatabase connection = perPostConnection(FILTERED_POST_COUNT);
+
+    QBENCHMARK {
+        loadPerPost(connection, accountIdFilter);
+    }
+}
+
+void tst_PostCache::tempTableFilter_data()
+{
+    addAccountFilters();
+}
+
+void tst_PostCache::tempTableFilter()
+{
+    QFETCH(QVariantList, accountIdFilter);
+
+    AbstractSocialPostCacheDatabase *setBased = database(FILTERED_POST_COUNT);
+    setBased->setAccountIdFilter(accountIdFilter);
+
+    QBENCHMARK {
+        setBased->refresh();
+        setBased->wait();
+    }
+    setBased->setAccountIdFilter(QVariantList());
+}
+
+void tst_PostCache::readLatency_data()
+{
+    QTest::addColumn<bool>("writing");
+
+    QTest::newRow("idle") << false;
+    QTest::newRow("during 5k post writes") << true;
+}
+
+void tst_PostCache::readLatency()
+{
+    QFETCH(bool, writing);
+
+    // A file of its own, as the writes grow it
+    const int postCount = 1000 + (writing ? 1 : 0);
+    database(postCount);
+
+    AbstractSocialPostCacheDatabase reader(QStringLiteral("benchmark"), databaseFile(postCount));
+    reader.setPageSize(READ_PAGE_SIZE);
+    AbstractSocialPostCacheDatabase writer(QStringLiteral("benchmark"), databaseFile(postCount));
+
+    QList<qint64> latencies;
+    int readsDuringWrites = 0;
+    QElapsedTimer timer;
+    for (int round = 0; round < WRITE_ROUNDS; ++round) {
+        if (writing) {
+            queuePosts(&writer, WRITE_POST_COUNT, postCount + round * WRITE_POST_COUNT);
+            writer.commit();
+        }
+
+        // Idle rounds read as often as the write rounds do at least
+        int reads = 0;
+        do {
+            timer.start();
+            reader.refresh();
+            reader.wait();
+            latencies.append(timer.nsecsElapsed() / 1000);
+            QCOMPARE(reader.posts().count(), READ_PAGE_SIZE);
+
+            ++reads;
+            // Delivers the end of the write to writeStatus()
+            QCoreApplication::processEvents();
+            if (writing && writer.writeStatus() == AbstractSocialCacheDatabase::Executing) {
+                ++readsDuringWrites;
+            }
+        } while (writing ? writer.writeStatus() == AbstractSocialCacheDatabase::Executing
+                         : reads < 20);
+
+        writer.wait();
+        QCOMPARE(writer.writeStatus(), writing ? AbstractSocialCacheDatabase::Finished
+                                               : AbstractSocialCacheDatabase::Null);
+    }
+
+    qDebug() << "reads:" << latencies.count()
+             << "median:" << percentile(latencies, 50) << "us"
+             << "p95:" << percentile(latencies, 95) << "us"
+             << "max:" << percentile(latencies, 100) << "us";
+    if (writing) {
+        // The reads were not queued behind the write transactions
+        QVERIFY(readsDuringWrites > 0);
+    }
+    QTest::setBenchmarkResult(percentile(latencies, 95) / 1000.0, QTest::WalltimeMilliseconds);
+}
+
+QTEST_GUILESS_MAIN(tst_PostCache)
+
+#include "tst_postcache.moc"
@@ -0,0 +1,20 @@
+# Standalone benchmark of ProcessMutex under contention from several
+# processes. It is not part of the main build; run qmake on this file
+# directly.
+
+TEMPLATE = app
+TARGET = tst_processmutex
+
+QT -= gui
+QT += testlib
+
+CONFIG += testcase
+
+LIBS += -lrt
+
+INCLUDEPATH += $$PWD/../../../libsocialcache/socialcache
+
+HEADERS += $$PWD/../../../libsocialcache/socialcache/semaphore_p.h
+SOURCES += \
+    $$PWD/../../../libsocialcache/socialcache/semaphore_p.cpp \
+    $$PWD/tst_processmutex.cpp
@@ -0,0 +1,210 @@
+/****************************************************************************
+ **
+ ** Copyright (C) 2026 Jolla Ltd.
+ **
+ ** This program/library is free software; you can redistribute it and/or
+ ** modify it under the terms of the GNU Lesser General Public License
+ ** version 2.1 as published by the Free Software Foundation.
+ **
+ ** This program/library is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ ** Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public
+ ** License along with this program/library; if not, write to the Free
+ ** Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ ** 02110-1301 USA
+ **
+ ****************************************************************************/
+
+#include "semaphore_p.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/wait.h>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QThread>
+#include <QtTest/QtTest>
+
+/*
+    Four processes take the write lock of one database in turn, as the
+    sync plugins of the different data types do when they write at the
+    same time. Each holds the lock while it increments a counter in a
+    file, so a lock that fails to exclude the others loses increments.
+
+    ProcessMutex, which blocks in flock() until it is woken, is compared
+    against the loop it replaced, which polled flock(LOCK_NB) with sleeps
+    backing off up to 50 ms.
+*/
+
+namespace {
+    const int PROCESS_COUNT = 4;
+    const int LOCK_TIMEOUT = 30000;
+
+    bool pollingLock(int fd, int timeout)
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        int backoff = 1;
+        Q_FOREVER {
+            if (::flock(fd, LOCK_EX | LOCK_NB) == 0) {
+                return true;
+            } else if (errno != EWOULDBLOCK && errno != EINTR) {
+                return false;
+            } else if (timer.elapsed() >= timeout) {
+                return false;
+            }
+            QThread::msleep(backoff);
+            backoff = qMin(backoff * 2, 50);
+        }
+    }
+
+    bool increment(const QString &counterPath, int holdUsecs)
+    {
+        QFile counter(counterPath);
+        if (!counter.open(QIODevice::ReadWrite)) {
+            return false;
+        }
+        const int value = counter.readAll().toInt();
+        if (holdUsecs > 0) {
+            ::usleep(holdUsecs);
+        }
+        counter.resize(0);
+        counter.seek(0);
+        return counter.write(QByteArray::number(value + 1)) > 0;
+    }
+
+    // Runs in a child process; returns its exit status
+    int contend(const QString &lockPath, const QString &counterPath,
+                int iterations, int holdUsecs, bool polling)
+    {
+        ProcessMutex mutex(lockPath);
+        const int fd = ::open(QFile::encodeName(lockPath).constData(), O_RDWR | O_CLOEXEC);
+        if (fd == -1) {
+            return 1;
+        }
+
+        for (int i = 0; i < iterations; ++i) {
+            if (!(polling ? pollingLock(fd, LOCK_TIMEOUT) : mutex.lock(LOCK_TIMEOUT))) {
+                return 1;
+            }
+            const bool ok = increment(counterPath, holdUsecs);
+            if (polling) {
+                ::flock(fd, LOCK_UN);
+            } else {
+                mutex.unlock();
+            }
+            if (!ok) {
+                return 1;
+            }
+        }
+
+        ::close(fd);
+        return 0;
+    }
+
+    bool runProcesses(const QString &lockPath, const QString &counterPath,
+                      int iterations, int holdUsecs, bool polling)
+    {
+        QList<pid_t> children;
+        for (int i = 0; i < PROCESS_COUNT; ++i) {
+            const pid_t pid = ::fork();
+            if (pid == 0) {
+                ::_exit(contend(lockPath, counterPath, iterations, holdUsecs, polling));
+            } else if (pid > 0) {
+                children.append(pid);
+            }
+        }
+
+        bool ok = children.count() == PROCESS_COUNT;
+        Q_FOREACH (pid_t pid, children) {
+            int status = 0;
+            if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                ok = false;
+            }
+        }
+        return ok;
+    }
+}
+
+class tst_ProcessMutex : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void contention_data();
+    void contention();
+    void timeout();
+};
+
+void tst_ProcessMutex::contention_data()
+{
+    QTest::addColumn<bool>("polling");
+    QTest::addColumn<int>("iterations");
+    QTest::addColumn<int>("holdUsecs");
+
+    // Short writes, like touching a few rows, and batch sized ones
+    QTest::newRow("blocking, 1 ms held") << false << 200 << 1000;
+    QTest::newRow("polling, 1 ms held") << true << 200 << 1000;
+    QTest::newRow("blocking, 20 ms held") << false << 25 << 20000;
+    QTest::newRow("polling, 20 ms held") << true << 25 << 20000;
+}
+
+void tst_ProcessMutex::contention()
+{
+    QFETCH(bool, polling);
+    QFETCH(int, iterations);
+    QFETCH(int, holdUsecs);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString lockPath = dir.path() + QStringLiteral("/db.lock");
+    const QString counterPath = dir.path() + QStringLiteral("/counter");
+
+    QFile lockFile(lockPath);
+    QVERIFY(lockFile.open(QIODevice::WriteOnly));
+    lockFile.close();
+
+    bool ok = false;
+    QBENCHMARK_ONCE {
+        ok = runProcesses(lockPath, counterPath, iterations, holdUsecs, polling);
+    }
+    QVERIFY(ok);
+
+    QFile counter(counterPath);
+    QVERIFY(counter.open(QIODevice::ReadOnly));
+    QCOMPARE(counter.readAll().toInt(), PROCESS_COUNT * iterations);
+}
+
+void tst_ProcessMutex::timeout()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString lockPath = dir.path() + QStringLiteral("/db.lock");
+
+    ProcessMutex holder(lockPath);
+    QVERIFY(holder.lock(0));
+
+    ProcessMutex waiter(lockPath);
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!waiter.lock(200));
+    QVERIFY(timer.elapsed() >= 200);
+    QVERIFY(timer.elapsed() < 1000);
+
+    QVERIFY(holder.unlock());
+    QVERIFY(waiter.lock(200));
+    QVERIFY(waiter.unlock());
+}
+
+QTEST_GUILESS_MAIN(tst_ProcessMutex)
+
+#include "tst_processmutex.moc"
@@ -0,0 +1,41 @@
+# Builds the socialcache library sources into a standalone benchmark, the
+# way libsocialcache/ubports.pro builds the library. Benchmarks of the
+# image downloader add "socialcache_images" to CONFIG before including it.
+
+QT += sql
+
+LIBS += -lrt
+
+SOCIALCACHE_DIR = $$PWD/../../libsocialcache/socialcache
+
+INCLUDEPATH += $$SOCIALCACHE_DIR
+
+DEFINES += 'PRIVILEGED_DATA_DIR=\'QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + \"/system/privileged/\"\''
+
+HEADERS += \
+    $$SOCIALCACHE_DIR/semaphore_p.h \
+    $$SOCIALCACHE_DIR/socialsyncinterface.h \
+    $$SOCIALCACHE_DIR/abstractsocialcachedatabase.h \
+    $$SOCIALCACHE_DIR/abstractsocialcachedatabase_p.h \
+    $$SOCIALCACHE_DIR/abstractsocialpostcachedatabase.h
+
+SOURCES += \
+    $$SOCIALCACHE_DIR/semaphore_p.cpp \
+    $$SOCIALCACHE_DIR/socialsyncinterface.cpp \
+    $$SOCIALCACHE_DIR/abstractsocialcachedatabase.cpp \
+    $$SOCIALCACHE_DIR/abstractsocialpostcachedatabase.cpp
+
+socialcache_images {
+    QT += gui network
+
+    HEADERS += \
+        $$SOCIALCACHE_DIR/abstractimagedownloader.h \
+        $$SOCIALCACHE_DIR/abstractimagedownloader_p.h \
+        $$SOCIALCACHE_DIR/socialimagesdatabase.h \
+        $$SOCIALCACHE_DIR/timeoutwheel.h
+
+    SOURCES += \
+        $$SOCIALCACHE_DIR/abstractimagedownloader.cpp \
+        $$SOCIALCACHE_DIR/socialimagesdatabase.cpp \
+        $$SOCIALCACHE_DIR/timeoutwheel.cpp
+}